@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#include "pqkmod.h"
+
+#define RED         "\x1B[31m"
+#define RESET       "\x1B[0m"
+
+
+/**
+ * Load generator for the priority-queue module
+ *
+ * Spawns `-p` producer and `-c` consumer processes that all attach to one
+ * named queue and hammer it for `-t` seconds, then prints a single JSON
+ * object with the throughput and the p50/p99/p999 latencies of each side.
+ *
+ * Producers insert through `-I`:
+ *     ioctl  PB2_INSERT_INT followed by PB2_INSERT_PRIO
+ *     write  one 8-byte (value, priority) record
+ *     mix    either of the above, picked at random for every item
+ * Consumers extract through `-E`:
+ *     min    PB2_GET_MIN
+ *     max    PB2_GET_MAX
+ *     read   one 8-byte (value, priority) record
+ *     mix    any of the above, picked at random for every item
+ * Priorities follow `-d`:
+ *     uniform   uniform over [1, range]
+ *     monotone  increasing per producer, wrapping around after `range`
+ *     skewed    concentrated towards 1, as `range` * u^4 for uniform u
+ *
+ * Consumers are non-blocking: extracts from an empty queue and inserts into
+ * a full one are counted apart and left out of the latencies.
+ *
+ * Usage: ./bench [-p producers] [-c consumers] [-t seconds] [-q capacity]
+ *                [-I ioctl|write|mix] [-E min|max|read|mix]
+ *                [-d uniform|monotone|skewed] [-R range]
+ */
+
+/**
+ * Log-linear latency histogram: values below `SUB` ns get a bucket each,
+ * above that every power of two is split in `SUB` buckets, so percentiles
+ * are off by at most 1 / `SUB`.
+ */
+#define SUB_BITS    4
+#define SUB         (1 << SUB_BITS)
+#define BUCKETS     ((64 - SUB_BITS + 1) << SUB_BITS)
+
+struct result {
+    long     ops;                  /* successful operations */
+    long     rejected;             /* queue full (producers) or empty (consumers) */
+    uint64_t hist[BUCKETS];        /* latency histogram of successful operations */
+};
+
+struct config {
+    int         producers, consumers;
+    double      seconds;
+    int32_t     capacity, range;
+    const char *insert, *extract, *distribution;
+    char        name[PB2_NAME_LEN];
+};
+
+static int bucket_of(uint64_t ns) {
+    if (ns < SUB) return ns;
+    int msb = 63 - __builtin_clzll(ns);
+    return ((msb - SUB_BITS + 1) << SUB_BITS) | ((ns >> (msb - SUB_BITS)) & (SUB - 1));
+}
+
+/* Lower bound of the values counted in bucket `b` */
+static uint64_t bucket_value(int b) {
+    if (b < SUB) return b;
+    int msb = (b >> SUB_BITS) + SUB_BITS - 1;
+    return (uint64_t) (SUB | (b & (SUB - 1))) << (msb - SUB_BITS);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, one state per process */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int32_t next_priority(const struct config *config, uint64_t *state, int32_t *last) {
+    double u = (next_random(state) >> 11) * (1.0 / (1ULL << 53));
+
+    if (strcmp(config->distribution, "monotone") == 0) {
+        *last = *last % config->range + 1;
+        return *last;
+    }
+    if (strcmp(config->distribution, "skewed") == 0) {
+        u = u * u * u * u;
+    }
+    return 1 + (int32_t) (u * config->range) % config->range;
+}
+
+/* Open the device and join the benchmark queue, which the parent created */
+static int attach_queue(const struct config *config, int flags) {
+    struct obj_attach attach;
+    char proc_file[100] = "/proc/";
+
+    strcat(proc_file, DEVICE_NAME);
+    int fd = open(proc_file, O_RDWR | flags);
+    if (fd < 0) {
+        perror(RED "<bench>: Could not open file!\n" RESET);
+        exit(1);
+    }
+
+    memcpy(attach.name, config->name, sizeof(attach.name));
+    if (ioctl(fd, PB2_ATTACH, &attach)) {
+        perror(RED "<bench>: Could not attach to the queue!\n" RESET);
+        exit(1);
+    }
+    return fd;
+}
+
+/**
+ * Insert one item, 0 on success and -1 when the queue is full. An item value
+ * cached by PB2_INSERT_INT stays cached until its priority goes through.
+ */
+static int insert(int fd, const char *iface, uint64_t *state, int32_t value,
+                  int32_t priority, int *cached) {
+    if (strcmp(iface, "mix") == 0) {
+        iface = *cached || next_random(state) & 1 ? "ioctl" : "write";
+    }
+
+    if (strcmp(iface, "write") == 0) {
+        struct obj_item item = { value, priority };
+        return write(fd, &item, sizeof(item)) == sizeof(item) ? 0 : -1;
+    }
+
+    if (!*cached) {
+        if (ioctl(fd, PB2_INSERT_INT, &value)) return -1;
+        *cached = 1;
+    }
+    if (ioctl(fd, PB2_INSERT_PRIO, &priority)) return -1;
+    *cached = 0;
+    return 0;
+}
+
+/* Extract one item, 0 on success and -1 when the queue is empty */
+static int extract(int fd, const char *iface, uint64_t *state) {
+    static const char *ifaces[] = { "min", "max", "read" };
+    int32_t value;
+
+    if (strcmp(iface, "mix") == 0) {
+        iface = ifaces[next_random(state) % 3];
+    }
+
+    if (strcmp(iface, "read") == 0) {
+        struct obj_item item;
+        return read(fd, &item, sizeof(item)) == sizeof(item) ? 0 : -1;
+    }
+    return ioctl(fd, strcmp(iface, "min") == 0 ? PB2_GET_MIN : PB2_GET_MAX, &value) ? -1 : 0;
+}
+
+/* Body of a worker process, fills its slot of the shared `results` */
+static void worker(const struct config *config, int id, int producer, int start,
+                   struct result *result) {
+    int fd = attach_queue(config, O_NONBLOCK);
+    uint64_t state = 0x9E3779B97F4A7C15ULL * (id + 1) ^ getpid();
+    int32_t last = 0;
+    int cached = 0;
+    char c;
+
+    /* Wait until the parent releases all workers at once */
+    read(start, &c, 1);
+
+    uint64_t deadline = now_ns() + config->seconds * 1e9;
+    for (;;) {
+        int32_t priority = producer ? next_priority(config, &state, &last) : 0;
+        uint64_t begin = now_ns();
+        if (begin >= deadline) break;
+
+        int status = producer ?
+            insert(fd, config->insert, &state, id, priority, &cached) :
+            extract(fd, config->extract, &state);
+        uint64_t end = now_ns();
+
+        if (status) {
+            result->rejected++;
+        } else {
+            result->ops++;
+            result->hist[bucket_of(end - begin)]++;
+        }
+    }
+
+    close(fd);
+    exit(0);
+}
+
+/* Percentile `q` of the merged histograms of `results[0 .. n - 1]` */
+static uint64_t percentile(struct result *results, int n, double q) {
+    long total = 0, seen = 0;
+    int i, b;
+
+    for (i = 0; i < n; i++) total += results[i].ops;
+    if (total == 0) return 0;
+
+    for (b = 0; b < BUCKETS; b++) {
+        for (i = 0; i < n; i++) seen += results[i].hist[b];
+        if (seen >= q * total) return bucket_value(b);
+    }
+    return bucket_value(BUCKETS - 1);
+}
+
+static void print_side(const char *side, struct result *results, int n, double seconds,
+                       const char *rejected) {
+    long ops = 0, rejects = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        ops     += results[i].ops;
+        rejects += results[i].rejected;
+    }
+
+    printf("\"%s\": {\"workers\": %d, \"ops\": %ld, \"ops_per_sec\": %.0f, \"%s\": %ld, "
+        "\"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}}",
+        side, n, ops, ops / seconds, rejected, rejects,
+        (unsigned long long) percentile(results, n, 0.50),
+        (unsigned long long) percentile(results, n, 0.99),
+        (unsigned long long) percentile(results, n, 0.999));
+}
+
+static int one_of(const char *value, const char *choices[]) {
+    for (; *choices; choices++) {
+        if (strcmp(value, *choices) == 0) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *inserts[]       = { "ioctl", "write", "mix", NULL };
+    static const char *extracts[]      = { "min", "max", "read", "mix", NULL };
+    static const char *distributions[] = { "uniform", "monotone", "skewed", NULL };
+    struct config config = {
+        .producers = 1, .consumers = 1, .seconds = 5, .capacity = 100000,
+        .range = 1000000, .insert = "write", .extract = "read",
+        .distribution = "uniform",
+    };
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "p:c:t:q:I:E:d:R:")) != -1) {
+        switch (opt) {
+            case 'p': config.producers    = atoi(optarg); break;
+            case 'c': config.consumers    = atoi(optarg); break;
+            case 't': config.seconds      = atof(optarg); break;
+            case 'q': config.capacity     = atoi(optarg); break;
+            case 'I': config.insert       = optarg; break;
+            case 'E': config.extract      = optarg; break;
+            case 'd': config.distribution = optarg; break;
+            case 'R': config.range        = atoi(optarg); break;
+            default: goto usage;
+        }
+    }
+    if (config.producers < 0 || config.consumers < 0 || config.seconds <= 0 ||
+            config.range <= 0 || !one_of(config.insert, inserts) ||
+            !one_of(config.extract, extracts) ||
+            !one_of(config.distribution, distributions)) {
+        goto usage;
+    }
+
+    /* Create the queue; workers join it by name while `fd` keeps it alive */
+    char proc_file[100] = "/proc/";
+    strcat(proc_file, DEVICE_NAME);
+    int fd = open(proc_file, O_RDWR);
+    if (fd < 0) {
+        perror(RED "<bench>: Could not open file!\n" RESET);
+        exit(1);
+    }
+    if (ioctl(fd, PB2_SET_CAPACITY, &config.capacity)) {
+        perror(RED "<bench>: Error while initializing queue!\n" RESET);
+        exit(1);
+    }
+    snprintf(config.name, sizeof(config.name), "bench-%d", getpid());
+    struct obj_attach attach;
+    memcpy(attach.name, config.name, sizeof(attach.name));
+    if (ioctl(fd, PB2_ATTACH, &attach)) {
+        perror(RED "<bench>: Could not name the queue!\n" RESET);
+        exit(1);
+    }
+
+    int workers = config.producers + config.consumers;
+    struct result *results = mmap(NULL, (workers + 1) * sizeof(struct result),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror(RED "<bench>: Could not map results!\n" RESET);
+        exit(1);
+    }
+
+    int start[2];
+    if (pipe(start)) {
+        perror(RED "<bench>: Could not create pipe!\n" RESET);
+        exit(1);
+    }
+
+    for (i = 0; i < workers; i++) {
+        if (fork() == 0) {
+            close(start[1]);
+            close(fd);
+            worker(&config, i, i < config.producers, start[0], &results[i]);
+        }
+    }
+
+    /* Give every worker time to attach, then start them together */
+    close(start[0]);
+    sleep(1);
+    close(start[1]);
+    while (wait(NULL) > 0);
+
+    printf("{\"producers\": %d, \"consumers\": %d, \"seconds\": %.3f, \"capacity\": %d, "
+        "\"insert\": \"%s\", \"extract\": \"%s\", \"distribution\": \"%s\", \"range\": %d, ",
+        config.producers, config.consumers, config.seconds, config.capacity,
+        config.insert, config.extract, config.distribution, config.range);
+    print_side("producers_stats", results, config.producers, config.seconds, "full");
+    printf(", ");
+    print_side("consumers_stats", results + config.producers, config.consumers,
+        config.seconds, "empty");
+    printf("}\n");
+
+    close(fd);
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-p producers] [-c consumers] [-t seconds] [-q capacity]\n"
+        "       [-I ioctl|write|mix] [-E min|max|read|mix]\n"
+        "       [-d uniform|monotone|skewed] [-R range]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* SIMD child selection of wide heaps, see pqkmod_heap.h */
+static int simd;
+#define heap_simd_enabled() simd
+
+#include "pqkmod_heap.h"
+#include "pqkmod_radix.h"
+#include "pqkmod_bucket.h"
+
+#define RED         "\x1B[31m"
+#define RESET       "\x1B[0m"
+
+#define MIN_OPS     (1 << 20)      /* operations timed per size, at least */
+
+
+/**
+ * Userspace microbenchmark of the heap engine (pqkmod_heap.h)
+ *
+ * Times the heap routines compiled into the module, without loading it, for
+ * heaps of 10^2 up to `-n` items (10^7 by default):
+ *     push     insert n items into an empty heap
+ *     pop-min  extract the minimum until a heap of n items is empty
+ *     pop-max  extract the maximum until a heap of n items is empty
+ *     mixed    on a heap of n items, push one item and pop the minimum or the
+ *              maximum (at random), n times; both halves count as operations
+ *     monotone on a heap of n items, pop the minimum and push an item due a
+ *              random delay after it, n times, like a timer queue; both
+ *              halves count as operations
+ * With `-r` the radix engine (pqkmod_radix.h) is timed instead, which only
+ * runs the workloads that extract minimums, and with `-b` the bucket engine
+ * (pqkmod_bucket.h), which skips the monotone workload as its priorities
+ * outgrow the range. Small sizes are repeated until at least MIN_OPS
+ * operations are timed. The cost is reported in TSC cycles per operation on
+ * x86, in nanoseconds elsewhere. Priorities are uniform random in 1 .. `-p`
+ * range (the whole positive range by default, 1024 with `-b`), drawn from
+ * `-s` seed before timing starts. Build with `make heapbench HEAP_ARITY=4`
+ * (or 8) to compare wide heaps with binary ones; wide heaps use AVX2 child
+ * selection when the CPU supports it, unless `-S` forces the scalar loop.
+ *
+ * Usage: ./heapbench [-n max_size] [-s seed] [-S] [-r | -b] [-p range]
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UNIT "cycles"
+static uint64_t ticks(void) {
+    return __rdtsc();
+}
+#else
+#define UNIT "ns"
+static uint64_t ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static volatile int32_t sink;      /* keeps popped values alive */
+
+static enum { HEAP, RADIX, BUCKET } engine;   /* engine under test */
+static struct radix_heap rh;
+static struct bucket_queue bq;
+
+/* Insert and extract with the engine under test */
+static inline void push(struct item_t *items, size_t *count, struct item_t item) {
+    switch (engine) {
+        case HEAP:   heap_push(items, count, item, 0, NULL); break;
+        case RADIX:  radix_push(&rh, items, count, item); break;
+        case BUCKET: bucket_push(&bq, items, count, item); break;
+    }
+}
+
+static inline struct item_t pop(struct item_t *items, size_t *count, int max) {
+    switch (engine) {
+        case RADIX:  return radix_pop(&rh, items, count);
+        case BUCKET: return bucket_pop(&bq, items, count, max);
+        default:     return heap_pop(items, count, max ? heap_max_index(items, *count) : 0, NULL);
+    }
+}
+
+/* Fill `items` with `n` items and turn them into a heap, untimed */
+static void build(struct item_t *items, const int32_t *prios, size_t n, int shift) {
+    for (size_t i = 0; i < n; i++) {
+        items[i] = (struct item_t) { (int32_t) i, prios[i] >> shift };
+    }
+    switch (engine) {
+        case HEAP:   heap_build(items, n, NULL); break;
+        case RADIX:  radix_build(&rh, items, n); break;
+        case BUCKET: bucket_build(&bq, items, n); break;
+    }
+}
+
+static uint64_t bench_push(struct item_t *items, const int32_t *prios, size_t n) {
+    size_t count = 0;
+
+    build(items, prios, 0, 0);
+    uint64_t start = ticks();
+    for (size_t i = 0; i < n; i++) {
+        push(items, &count, (struct item_t) { (int32_t) i, prios[i] });
+    }
+    return ticks() - start;
+}
+
+static uint64_t bench_pop(struct item_t *items, const int32_t *prios, size_t n, int max) {
+    size_t count = n;
+    int32_t sum = 0;
+
+    build(items, prios, n, 0);
+    uint64_t start = ticks();
+    while (count > 0) {
+        sum += pop(items, &count, max).value;
+    }
+    uint64_t elapsed = ticks() - start;
+
+    sink = sum;
+    return elapsed;
+}
+
+static uint64_t bench_mixed(struct item_t *items, const int32_t *prios, size_t n) {
+    size_t count = n;
+    int32_t sum = 0;
+
+    build(items, prios, n, 0);
+    uint64_t start = ticks();
+    for (size_t i = 0; i < n; i++) {
+        /* Reuse the priorities in another order for the pushed items */
+        int32_t prio = prios[(i * 7919) % n];
+        push(items, &count, (struct item_t) { (int32_t) i, prio });
+        sum += pop(items, &count, prio & 1).value;
+    }
+    uint64_t elapsed = ticks() - start;
+
+    sink = sum;
+    return elapsed;
+}
+
+static uint64_t bench_monotone(struct item_t *items, const int32_t *prios, size_t n) {
+    size_t count = n;
+    int32_t sum = 0;
+
+    /* Due times up to 2^29 and delays up to 2^22 keep priorities positive */
+    build(items, prios, n, 2);
+    uint64_t start = ticks();
+    for (size_t i = 0; i < n; i++) {
+        struct item_t item = pop(items, &count, 0);
+        sum += item.value;
+
+        item.priority += prios[(i * 7919) % n] >> 9;
+        push(items, &count, item);
+    }
+    uint64_t elapsed = ticks() - start;
+
+    sink = sum;
+    return elapsed;
+}
+
+/* Print the cost per operation, or a dash for workloads that were not run */
+static void print_cost(uint64_t elapsed, double ops) {
+    if (ops == 0) {
+        printf(" %14s", "-");
+    } else {
+        printf(" %14.1f", elapsed / ops);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_size = 10000000;
+    unsigned int seed = 1;
+    int32_t range = 0;
+    int opt;
+
+#ifdef HEAP_SIMD
+    simd = __builtin_cpu_supports("avx2");
+#endif
+    while ((opt = getopt(argc, argv, "n:s:Srbp:")) != -1) {
+        switch (opt) {
+            case 'n': max_size = strtoul(optarg, NULL, 10); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            case 'S': simd = 0; break;
+            case 'r': engine = RADIX; break;
+            case 'b': engine = BUCKET; break;
+            case 'p': range = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n max_size] [-s seed] [-S] [-r | -b] "
+                    "[-p range]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (engine == BUCKET && range == 0) {
+        range = 1024;
+    }
+    if (range < 0 || (engine == BUCKET && range > BUCKET_MAX_RANGE)) {
+        fprintf(stderr, RED "<heapbench>: Invalid priority range!\n" RESET);
+        exit(1);
+    }
+
+    /* Aligned like the module's arrays, with one spare slot for the push of
+       the mixed workload */
+    struct item_t *items = NULL;
+    int32_t *prios = malloc(max_size * sizeof(int32_t));
+    if (posix_memalign((void **) &items, 64, (max_size + 1 + HEAP_PAD) * sizeof(struct item_t)) ||
+            prios == NULL) {
+        perror(RED "<heapbench>: Could not allocate items!\n" RESET);
+        exit(1);
+    }
+
+    srandom(seed);
+    for (size_t i = 0; i < max_size; i++) {
+        prios[i] = range ? 1 + random() % range : random();
+    }
+
+    if (engine == BUCKET) {
+        bq.range = range;
+        bq.head  = malloc(range * sizeof(uint32_t));
+        bq.tail  = malloc(range * sizeof(uint32_t));
+        bq.next  = malloc((max_size + 1) * sizeof(uint32_t));
+        bq.prev  = malloc((max_size + 1) * sizeof(uint32_t));
+        if (!bq.head || !bq.tail || !bq.next || !bq.prev) {
+            perror(RED "<heapbench>: Could not allocate buckets!\n" RESET);
+            exit(1);
+        }
+    }
+
+    items += HEAP_PAD;
+    if (engine == RADIX) {
+        printf("[*] Radix heap");
+    } else if (engine == BUCKET) {
+        printf("[*] Bucket queue");
+    } else {
+        printf("[*] %d-ary heap, %s child selection", HEAP_ARITY, simd ? "AVX2" : "scalar");
+    }
+    if (range) {
+        printf(", priorities 1 .. %d", range);
+    }
+    printf("\n");
+    printf("%10s %14s %14s %14s %14s %14s   (" UNIT "/op)\n",
+        "size", "push", "pop-min", "pop-max", "mixed", "monotone");
+
+    for (size_t n = 100; n <= max_size; n *= 10) {
+        size_t rounds = n < MIN_OPS ? (MIN_OPS + n - 1) / n : 1;
+        uint64_t push = 0, pop_min = 0, pop_max = 0, mixed = 0, monotone = 0;
+
+        for (size_t round = 0; round < rounds; round++) {
+            push    += bench_push(items, prios, n);
+            pop_min += bench_pop (items, prios, n, 0);
+            if (engine != RADIX) {
+                pop_max += bench_pop  (items, prios, n, 1);
+                mixed   += bench_mixed(items, prios, n);
+            }
+            if (engine != BUCKET) {
+                monotone += bench_monotone(items, prios, n);
+            }
+        }
+
+        double ops = (double) n * rounds;
+        printf("%10zu", n);
+        print_cost(push, ops);
+        print_cost(pop_min, ops);
+        print_cost(pop_max, engine != RADIX ? ops : 0);
+        print_cost(mixed, engine != RADIX ? 2 * ops : 0);
+        print_cost(monotone, engine != BUCKET ? 2 * ops : 0);
+        printf("\n");
+    }
+
+    free(prios);
+    free(items - HEAP_PAD);
+    free(bq.head);
+    free(bq.tail);
+    free(bq.next);
+    free(bq.prev);
+    return 0;
+}
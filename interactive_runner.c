@@ -7,25 +7,12 @@
 #include <fcntl.h>
 #include <string.h>
 
-#define PERMS 0666                         /* all users can read and write */
-#define DEVICE_NAME "cs60038_a2_17"
-
-#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
-#define PB2_INSERT_INT   _IOW(0x10, 0x32, int32_t *)
-#define PB2_INSERT_PRIO  _IOW(0x10, 0x33, int32_t *) 
-#define PB2_GET_INFO     _IOW(0x10, 0x34, int32_t *)
-#define PB2_GET_MIN      _IOW(0x10, 0x35, int32_t *)
-#define PB2_GET_MAX      _IOW(0x10, 0x36, int32_t *)
+#include "pqkmod.h"
 
 #define RED         "\x1B[31m"
 #define GRN         "\x1B[32m"
 #define RESET       "\x1B[0m"
 
-struct obj_info {
-	int32_t prio_que_size; 	/* current number of elements in priority-queue */
-	int32_t capacity;		/* maximum capacity of priority-queue */
-};
-
 
 int main(int argc, const char *argv[]) {
     int fd, status;
@@ -42,6 +29,12 @@ int main(int argc, const char *argv[]) {
     int ops, flag = 1;
     int32_t num;
     struct obj_info obj_info;
+    struct obj_item obj_item;
+    struct obj_item obj_items[100];
+    struct obj_batch obj_batch;
+    struct obj_attach obj_attach;
+    struct obj_indexed obj_indexed;
+    struct obj_handle obj_handle;
 
     while (flag) {
         /* Print menu */
@@ -52,8 +45,18 @@ int main(int argc, const char *argv[]) {
         printf("[4] GET_INFO\n");
         printf("[5] GET_MIN\n");
         printf("[6] GET_MAX\n");
-        printf("[7] Exit\n");
-        printf("\n[*] Enter your choice [1..7]: ");
+        printf("[7] PEEK_MIN\n");
+        printf("[8] PEEK_MAX\n");
+        printf("[9] INSERT_BATCH\n");
+        printf("[10] EXTRACT_MIN_N\n");
+        printf("[11] EXTRACT_MAX_N\n");
+        printf("[12] ATTACH\n");
+        printf("[13] SET_INDEXED\n");
+        printf("[14] INSERT_HANDLE\n");
+        printf("[15] UPDATE\n");
+        printf("[16] DELETE\n");
+        printf("[17] Exit\n");
+        printf("\n[*] Enter your choice [1..17]: ");
         scanf("%d", &ops);
     
         switch (ops) {
@@ -124,6 +127,127 @@ int main(int argc, const char *argv[]) {
                 break;
             
             case 7:
+                status = ioctl(fd, PB2_PEEK_MIN, &obj_item);
+                if (status) {
+                    perror(RED "[-] Error while reading minimum!\n" RESET);
+                    close(fd);
+                    exit(1);
+                }
+                printf("[+] Minimum priority item: %d (priority %d)\n", obj_item.value, obj_item.priority);
+                break;
+
+            case 8:
+                status = ioctl(fd, PB2_PEEK_MAX, &obj_item);
+                if (status) {
+                    perror(RED "[-] Error while reading maximum!\n" RESET);
+                    close(fd);
+                    exit(1);
+                }
+                printf("[+] Maximum priority item: %d (priority %d)\n", obj_item.value, obj_item.priority);
+                break;
+            
+            case 9:
+                printf("[*] Enter number of items (at most 100): ");
+                scanf("%d", &num);
+                if (num < 0 || num > 100) {
+                    printf("[-] Invalid number of items!\n");
+                    break;
+                }
+                for (int i = 0; i < num; i++) {
+                    printf("[*] Enter value and priority of item %d: ", i + 1);
+                    scanf("%d %d", &obj_items[i].value, &obj_items[i].priority);
+                }
+                obj_batch.count = num;
+                obj_batch.items = (uint64_t) (uintptr_t) obj_items;
+                status = ioctl(fd, PB2_INSERT_BATCH, &obj_batch);
+                if (status) {
+                    perror(RED "[-] Error while pushing items to queue!\n" RESET);
+                    printf("[-] %d of %d items were pushed.\n", obj_batch.done, num);
+                    close(fd);
+                    exit(1);
+                }
+                printf("[+] %d items successfully pushed.\n", obj_batch.done);
+                break;
+
+            case 10:
+            case 11:
+                printf("[*] Enter number of items (at most 100): ");
+                scanf("%d", &num);
+                if (num < 0 || num > 100) {
+                    printf("[-] Invalid number of items!\n");
+                    break;
+                }
+                obj_batch.count = num;
+                obj_batch.items = (uint64_t) (uintptr_t) obj_items;
+                status = ioctl(fd, ops == 10 ? PB2_EXTRACT_MIN_N : PB2_EXTRACT_MAX_N, &obj_batch);
+                if (status) {
+                    perror(RED "[-] Error while extracting items!\n" RESET);
+                    close(fd);
+                    exit(1);
+                }
+                printf("[+] Extracted %d items:\n", obj_batch.done);
+                for (int i = 0; i < obj_batch.done; i++) {
+                    printf("    %d (priority %d)\n", obj_items[i].value, obj_items[i].priority);
+                }
+                break;
+
+            case 12:
+                printf("[*] Enter queue name (at most %d characters): ", PB2_NAME_LEN - 1);
+                memset(&obj_attach, 0, sizeof(obj_attach));
+                scanf("%31s", obj_attach.name);
+                status = ioctl(fd, PB2_ATTACH, &obj_attach);
+                if (status) {
+                    perror(RED "[-] Error while attaching to queue!\n" RESET);
+                    break;
+                }
+                printf("[+] Attached to queue \"%s\".\n", obj_attach.name);
+                break;
+
+            case 13:
+                printf("[*] Merge items of equal value (0 or 1): ");
+                scanf("%d", &obj_indexed.upsert);
+                status = ioctl(fd, PB2_SET_INDEXED, &obj_indexed);
+                if (status) {
+                    perror(RED "[-] Error while indexing queue!\n" RESET);
+                    break;
+                }
+                printf("[+] Queue is indexed.\n");
+                break;
+
+            case 14:
+                printf("[*] Enter item value and priority: ");
+                scanf("%d %d", &obj_handle.value, &obj_handle.priority);
+                status = ioctl(fd, PB2_INSERT_HANDLE, &obj_handle);
+                if (status) {
+                    perror(RED "[-] Error while inserting item!\n" RESET);
+                    break;
+                }
+                printf("[+] Inserted item with handle %d.\n", obj_handle.handle);
+                break;
+
+            case 15:
+                printf("[*] Enter item handle and new priority: ");
+                scanf("%d %d", &obj_handle.handle, &obj_handle.priority);
+                status = ioctl(fd, PB2_UPDATE, &obj_handle);
+                if (status) {
+                    perror(RED "[-] Error while updating item!\n" RESET);
+                    break;
+                }
+                printf("[+] Updated item with handle %d.\n", obj_handle.handle);
+                break;
+
+            case 16:
+                printf("[*] Enter item handle: ");
+                scanf("%d", &obj_handle.handle);
+                status = ioctl(fd, PB2_DELETE, &obj_handle);
+                if (status) {
+                    perror(RED "[-] Error while deleting item!\n" RESET);
+                    break;
+                }
+                printf("[+] Deleted item %d (priority %d).\n", obj_handle.value, obj_handle.priority);
+                break;
+
+            case 17:
                 flag = 0;
                 break;
             
@@ -18,6 +18,54 @@
 #include <linux/mutex.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/kref.h>
+#include <linux/hashtable.h>
+#include <linux/stringhash.h>
+#include <linux/string.h>
+#include <linux/random.h>
+#include <linux/overflow.h>
+#include <linux/cpumask.h>
+#include <linux/mempool.h>
+#include <linux/jump_label.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hash.h>
+#include <linux/eventfd.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+
+#include "pqkmod.h"
+
+/* Same condition as `HEAP_SIMD`, which pqkmod_heap.h defines below */
+#if defined(CONFIG_X86_64) && defined(HEAP_ARITY) && HEAP_ARITY >= 4
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+
+/* AVX2 child selection of wide heaps (see pqkmod_heap.h and `simd`) */
+static DEFINE_STATIC_KEY_FALSE(simd_key);
+#define heap_simd_enabled() static_branch_likely(&simd_key)
+#define heap_simd_begin()   kernel_fpu_begin()
+#define heap_simd_end()     kernel_fpu_end()
+#endif
+
+#include "pqkmod_heap.h"
+#include "pqkmod_radix.h"
+#include "pqkmod_bucket.h"
+
+#define CREATE_TRACE_POINTS
+#include "pqkmod_trace.h"
 
 MODULE_AUTHOR("Utkarsh Patel");
 MODULE_DESCRIPTION("Loadable Kernel Module for implementing a Priority-queue");
@@ -29,36 +77,83 @@ MODULE_LICENSE("GPL");
 
 
 static DEFINE_MUTEX(qlock);                /* mutex lock over `queues` */
-#define PERMS 0666                         /* all users can read and write */
-#define DEVICE_NAME "cs60038_a2_17"
-
-#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
-#define PB2_INSERT_INT   _IOW(0x10, 0x32, int32_t *)
-#define PB2_INSERT_PRIO  _IOW(0x10, 0x33, int32_t *) 
-#define PB2_GET_INFO     _IOW(0x10, 0x34, int32_t *)
-#define PB2_GET_MIN      _IOW(0x10, 0x35, int32_t *)
-#define PB2_GET_MAX      _IOW(0x10, 0x36, int32_t *)
-
-struct obj_info {
-	int32_t prio_que_size; 	/* current number of elements in priority-queue */
-	int32_t capacity;		/* maximum capacity of priority-queue */
+static struct workqueue_struct *pqkmod_wq; /* grace periods of retained queues */
+
+/* Ioctl commands and their argument structures are declared in pqkmod.h */
+
+/**
+ * Diagnostic messages are only logged when the `debug` parameter is set,
+ * either at load time or through /sys/module/pqkmod/parameters/debug. It
+ * flips a static key, so the disabled checks cost a no-op on the hot paths.
+ * Tracepoints (see pqkmod_trace.h) are the low overhead way to observe the
+ * queues.
+ */
+static bool debug;
+static DEFINE_STATIC_KEY_FALSE(debug_key);
+
+static int set_debug(const char *val, const struct kernel_param *kp) {
+    int status = param_set_bool(val, kp);
+    if (status) {
+        return status;
+    }
+
+    if (debug) {
+        static_branch_enable(&debug_key);
+    } else {
+        static_branch_disable(&debug_key);
+    }
+    return 0;
+}
+
+static const struct kernel_param_ops debug_ops = {
+    .set = set_debug,
+    .get = param_get_bool,
 };
+module_param_cb(debug, &debug_ops, &debug, 0644);
+MODULE_PARM_DESC(debug, "Log every queue operation to the kernel log (default: off)");
 
+#define debug_printk(...)                                                   \
+    do {                                                                    \
+        if (static_branch_unlikely(&debug_key)) {                           \
+            printk(__VA_ARGS__);                                            \
+        }                                                                   \
+    } while (0)
+
+/**
+ * Wide heaps (built with HEAP_ARITY=4 or 8) search the children of a node
+ * with AVX2 on CPUs that support it, unless the module is loaded with
+ * `simd=0`. Reading the parameter back tells whether SIMD is in use.
+ */
+static bool simd = true;
+module_param(simd, bool, 0444);
+MODULE_PARM_DESC(simd, "Search wide heap nodes with AVX2 when available (default: on)");
 
 static ssize_t qwrite(struct file *, const char *, size_t, loff_t *);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+static ssize_t qread_iter(struct kiocb *, struct iov_iter *);
+#else
 static ssize_t qread (struct file *, char *      , size_t, loff_t *);
+#endif
 
 static int qopen   (struct inode *, struct file *);
 static int qrelease(struct inode *, struct file *);
 
 static long qioctl(struct file *, unsigned int, unsigned long);
+static int  qmmap (struct file *, struct vm_area_struct *);
+static __poll_t qpoll(struct file *, struct poll_table_struct *);
 
 static struct proc_ops proc_ops = {
     .proc_open    = qopen,
     .proc_release = qrelease,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+    .proc_read_iter = qread_iter,
+#else
     .proc_read    = qread,
+#endif
     .proc_write   = qwrite,
     .proc_ioctl   = qioctl,
+    .proc_mmap    = qmmap,
+    .proc_poll    = qpoll,
 };
 
 static int  _module_init(void);        /* routine to be passed to module_init */
@@ -68,114 +163,600 @@ module_init(_module_init);
 module_exit(_module_exit);
 
 
-/**
- * Wrapper for element in the priority queue
- */
-struct item_t {
-    int32_t value, priority;
-};
-
-
 /**
  * Wrapper for priority queue
  * 
- * Each priority queue is associated with a userspace process and each userspace
- * process can be associated with at most one priority queue.
+ * Each priority queue is associated with an open file (see `struct
+ * queue_list`) and a process can hold several of them.
+ * 
+ * Items are kept in a min-max heap (see pqkmod_heap.h), so both the minimum
+ * and the maximum priority items can be read in O(1) and extracted in
+ * O(log n).
+ * 
+ * The items array starts small and doubles whenever it is full, up to the
+ * queue's capacity, so that large queues only pay for the items they hold.
  */
 struct priority_queue {
     struct item_t   *items;        /* array of items */
     size_t          capacity;      /* maximum number of items possible */
     size_t          count;         /* current number of items */
+    size_t          allocated;     /* number of items `items` can hold */
+    struct queue_list *owner;      /* for tracing and statistics */
+    struct queue_index *index;     /* handles of the items, NULL if untracked */
+    struct radix_heap *radix;      /* radix engine state, NULL for the other engines */
+    struct bucket_queue *buckets;  /* bucket engine state, NULL for the other engines */
+    struct payload_arena *arena;   /* payloads of the items, NULL if they carry none */
+    struct delay_queue *delayed;   /* items not due yet, NULL until the first one */
+};
+
+/**
+ * Handles of the items of an indexed queue (see PB2_SET_INDEXED)
+ * 
+ * A handle is an id (its low `HEAP_ID_BITS` bits) and a 7-bit generation,
+ * which goes up every time the id is handed out again, so that the handle of
+ * a removed item is told apart from the ones of its next 127 successors. The
+ * heap routines keep `hs` up to date; handles of removed items are chained
+ * from `free` through `hs.positions`, which keeps their generation. In
+ * upsert mode, ids are also hashed by the value of their item into
+ * `buckets`, chained through `chain`.
+ * 
+ * The arrays only grow, and always have room for an id per allocated item:
+ * new ids are only handed out when every id below `ids` is in use.
+ */
+struct queue_index {
+    struct heap_slots hs;          /* position index of the heap */
+    u32             size;          /* length of `hs.slots`, `hs.positions` and `chain` */
+    u32             ids;           /* ids handed out so far */
+    u32             free;          /* last handle released, NO_ID when none */
+    bool            upsert;        /* at most one item per value */
+    u32             bits;          /* log2 of the number of buckets */
+    u32             *buckets;      /* first id of each bucket, NO_ID for none */
+    u32             *chain;        /* next id in the same bucket */
+};
+
+#define NO_ID              U32_MAX
+#define HANDLE_GENERATIONS 0x7f    /* handles stay positive as int32_t */
+
+/**
+ * Items of a queue held until their due time (see PB2_INSERT_DELAYED)
+ * 
+ * They wait in a binary min-heap on their due time, and `timer` is armed on
+ * the earliest one. The timer only schedules `work`, which takes the queue
+ * lock to move every due item into the queue at once and wake up readers.
+ * Extracting commands also move due items first, so they never wait for the
+ * work to run.
+ */
+struct delayed_item {
+    u64             due;           /* CLOCK_MONOTONIC nanoseconds */
+    struct item_t   item;
+};
+
+struct delay_queue {
+    struct delayed_item *heap;     /* min-heap on `due` */
+    size_t          count;         /* number of items held */
+    size_t          allocated;     /* number of items `heap` can hold */
+    struct hrtimer  timer;         /* fires at `heap[0].due` */
+    struct work_struct work;       /* releases due items, see `release_work` */
+    struct queue_list *owner;      /* queue the items go to */
+    bool            dying;         /* set on teardown, the timer stays off */
+};
+
+/**
+ * Payloads of the items of a queue (see PB2_SET_PAYLOAD)
+ * 
+ * Every queued item owns a slot of `data`, `stride` bytes holding its record
+ * exactly as userspace reads it: a `struct obj_payload` and up to `size`
+ * bytes of data. The item itself carries the id of its slot as its value,
+ * so the engines keep moving 8-byte items whatever the payload size. Slots
+ * of extracted items are chained from `free` through the `value` of their
+ * record.
+ * 
+ * Like the index, `data` only grows, and always has a slot per allocated
+ * item.
+ */
+struct payload_arena {
+    u32             size;          /* maximum bytes of data per item */
+    u32             stride;        /* bytes per slot, a multiple of 8 */
+    u32             slots;         /* number of slots in `data` */
+    u32             ids;           /* slots handed out so far */
+    u32             free;          /* first free slot, NO_ID when none */
+    u8              *data;         /* array of slots */
 };
 
-#define MAX_PQ_CAPACITY 100        /* every queue's max_capacity should be less
+#define MAX_PQ_CAPACITY (1 << 24)  /* every queue's max_capacity should be less
                                       or equal to MAX_PQ_CAPACITY */
+#define MIN_PQ_ALLOC    64         /* items allocated for a new queue */
 
 /**
- * Routines for handling priority queue
+ * Allocation of queue structures
+ * 
+ * Files are opened and closed at a high rate, so the fixed-size structures
+ * come from dedicated slab caches. Item arrays of up to `MAX_CLASS_ITEMS`
+ * items are rounded up to a power of two and served by one cache per size
+ * class, each backed by a mempool holding a few arrays in reserve. Larger
+ * arrays use kvmalloc.
  */
-#define LCHILD(x) (x) * 2 + 1
-#define RCHILD(x) (x) * 2 + 2
-#define PARENT(x) ((x) - 1) / 2
+#define ITEM_CLASSES      4        /* arrays of 64, 128, 256 and 512 items */
+#define MAX_CLASS_ITEMS   (MIN_PQ_ALLOC << (ITEM_CLASSES - 1))
+#define ITEM_POOL_RESERVE 16       /* arrays kept in reserve per class */
+
+static struct kmem_cache *queue_list_cache;
+static struct kmem_cache *queue_file_cache;
+static struct kmem_cache *queue_cache;
+static struct kmem_cache *item_caches[ITEM_CLASSES];
+static mempool_t         *item_pools [ITEM_CLASSES];
+
+static int           create_caches (void);
+static void          destroy_caches(void);
+static size_t        round_items   (size_t);
+static struct item_t *alloc_items  (size_t);
+static void          free_items    (struct item_t *, size_t);
 
-static struct priority_queue *create_queue(size_t);
+/**
+ * Routines for handling priority queue
+ */
+static struct priority_queue *create_queue(size_t, struct queue_list *);
 static void                  free_queue   (struct priority_queue *);
-static void                  swap_items   (struct item_t *, struct item_t *);
-static int                   compare_items(struct item_t, struct item_t);
+static int                   resize_items (struct priority_queue *, size_t);
+static size_t                reserve_items(struct priority_queue *, size_t);
+static int                   set_capacity (struct priority_queue *, size_t);
 static int                   remove_item  (struct priority_queue *, size_t);
-static int                   push         (struct priority_queue *, struct item_t);
+static int                   push         (struct priority_queue *, struct item_t, int32_t *);
+static void                  push_appended(struct priority_queue *, size_t);
+static void                  restore_items(struct priority_queue *, size_t);
+static int                   check_prio   (struct priority_queue *, int32_t);
+static struct item_t         pop_item     (struct priority_queue *, int);
 static int32_t               extract_min  (struct priority_queue *);
 static int32_t               extract_max  (struct priority_queue *);
-static void                  heapify      (struct priority_queue *, size_t);
-static int                   decrease_prio(struct priority_queue *, size_t, int32_t);
+static struct item_t        *peek_min     (struct priority_queue *);
+static struct item_t        *peek_max     (struct priority_queue *);
+static int                   change_prio  (struct priority_queue *, size_t, int32_t);
+static size_t                extract_n    (struct priority_queue *, size_t, int);
+static int                   set_engine   (struct priority_queue *, int32_t, int32_t);
+static int                   resize_buckets(struct priority_queue *, size_t);
+static void                  free_buckets (struct bucket_queue *);
+
+static int                   set_indexed  (struct priority_queue *, bool);
+static int                   resize_index (struct priority_queue *, size_t);
+static void                  free_index   (struct queue_index *);
+static u32                   new_handle   (struct queue_index *, int32_t);
+static void                  free_handle  (struct queue_index *, u32, int32_t);
+static long                  find_handle  (struct priority_queue *, int32_t);
+static long                  find_value   (struct priority_queue *, int32_t);
+
+static int                   set_payload  (struct priority_queue *, int32_t);
+static int                   resize_arena (struct priority_queue *, size_t);
+static void                  free_arena   (struct payload_arena *);
+static int                   push_payload (struct priority_queue *, struct obj_payload *);
+static int                   pop_payload  (struct priority_queue *, int, struct obj_payload *);
+
+static int                   push_delayed (struct priority_queue *, struct item_t, u64);
+static size_t                release_due  (struct priority_queue *);
+static void                  release_work (struct work_struct *);
+static enum hrtimer_restart  delay_timer  (struct hrtimer *);
+static void                  free_delayed (struct delay_queue *);
+
+static int                   save_snapshot(struct priority_queue *, struct obj_snapshot *);
+static int                   load_snapshot(struct priority_queue *, struct obj_snapshot *);
+
+/* Radix queues only keep track of their minimum */
+static inline bool tracks_max(struct priority_queue *queue) {
+    return queue->radix == NULL;
+}
+
+/* Handles and shards only work with the min-max heap engine */
+static inline bool is_heap(struct priority_queue *queue) {
+    return queue->radix == NULL && queue->buckets == NULL;
+}
+
+/* Items queued or held until due, which all count against the capacity */
+static inline size_t held_items(struct priority_queue *queue) {
+    return queue->count + (queue->delayed ? queue->delayed->count : 0);
+}
+
+/* Record of the item stored in slot `id` of an arena */
+static inline struct obj_payload *arena_slot(struct payload_arena *arena, u32 id) {
+    return (struct obj_payload *) (arena->data + (size_t) id * arena->stride);
+}
+
+/* Commands supported by queues carrying payloads */
+static inline bool payload_cmd(unsigned int cmd) {
+    switch (cmd) {
+        case PB2_SET_CAPACITY:
+        case PB2_CREATE:
+        case PB2_GET_INFO:
+        case PB2_PEEK_MIN:
+        case PB2_PEEK_MAX:
+        case PB2_SET_RELAXED:
+        case PB2_SET_INDEXED:
+        case PB2_SET_PAYLOAD:
+        case PB2_INSERT_PAYLOAD:
+        case PB2_GET_MIN_PAYLOAD:
+        case PB2_GET_MAX_PAYLOAD:
+        case PB2_SET_NOTIFY:
+        case PB2_SET_RETAIN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Position index of a queue for the heap routines, NULL if untracked */
+static inline struct heap_slots *queue_slots(struct priority_queue *queue) {
+    return queue->index ? &queue->index->hs : NULL;
+}
+
+
+/**
+ * Statistics of a priority queue
+ * 
+ * Kept per CPU, so that updating them never contends; readers sum the copies
+ * of every CPU. Bucket `i` of the latency histograms counts operations that
+ * took [2^i, 2^(i + 1)) ns, from entering the module to leaving it, which
+ * includes sleeping for an item in blocking extracts.
+ */
+#define STAT_BUCKETS 32
+
+struct queue_stats {
+    u64 inserts;                   /* items inserted */
+    u64 extracts;                  /* items extracted */
+    u64 overflows;                 /* items rejected as the queue was full */
+    u64 underflows;                /* extracts rejected as the queue was empty */
+    u64 insert_lat [STAT_BUCKETS]; /* write and PB2_INSERT_* but _INT */
+    u64 extract_lat[STAT_BUCKETS]; /* read, PB2_GET_*, PB2_EXTRACT_*_N, PB2_DELETE */
+};
+
+/**
+ * Watermark notifications of a priority queue (see PB2_SET_NOTIFY)
+ * 
+ * Strict queues compare the count after every operation with the one seen
+ * after the previous operation, under the queue lock. Relaxed queues compare
+ * the counts before and after each update of their atomic count, so every
+ * crossing is seen by exactly one operation without a lock; their
+ * registration no longer changes once they are split.
+ */
+#define NOTIFY_NONEMPTY 0          /* count rose from 0 */
+#define NOTIFY_HIGH     1          /* count rose above `high` */
+#define NOTIFY_LOW      2          /* count fell below `low` */
+#define NOTIFY_EVENTS   3
+
+struct queue_notify {
+    struct eventfd_ctx *ctx[NOTIFY_EVENTS]; /* NULL for events left out */
+    size_t          high;          /* high watermark */
+    size_t          low;           /* low watermark */
+    size_t          count;         /* count seen last, for strict queues */
+};
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+#define notify_signal(ctx) eventfd_signal(ctx)
+#else
+#define notify_signal(ctx) eventfd_signal(ctx, 1)
+#endif
 
-/* Linked list of priority queues */
+/**
+ * Priority queue together with its lock and waiters
+ * 
+ * Every `open` of the proc file creates an anonymous instance. Opened files
+ * may give their instance a name, or join the instance of that name, with
+ * PB2_ATTACH; an instance is freed when the last file referring to it is
+ * released, or at the end of its grace period if it is retained (see
+ * PB2_SET_RETAIN). All instances are linked in `queues`, for bookkeeping
+ * only, and named ones are also hashed in `named_queues`.
+ * 
+ * Each instance has its own lock, so operations on different queues never
+ * contend. `qlock` only serializes changes to `queues` and `named_queues`;
+ * `queues` is read under RCU. Relaxed instances (see `struct relaxed_queue`)
+ * bypass the instance lock altogether.
+ */
 struct queue_list {
-    pid_t pid;
-    struct priority_queue *queue;
-    struct queue_list *next;
+    pid_t pid;                     /* pid of the process that created it */
+    u32 id;                        /* unique, for tracing and statistics */
+    struct priority_queue *queue;  /* NULL once relaxed */
+    struct relaxed_queue *relaxed; /* set once by PB2_SET_RELAXED, then fixed */
+    struct list_head list;         /* entry in `queues` */
+    struct hlist_node node;        /* entry in `named_queues` (if named) */
+    struct rcu_head rcu;           /* deferred free after unlinking */
+    struct kref ref;               /* number of files attached, or 1 while retained */
+    char name[PB2_NAME_LEN];       /* empty for anonymous queues */
+    u32 retain;                    /* seconds kept after the last release */
+    bool retained;                 /* released, waiting for adoption */
+    struct delayed_work grace;     /* ends the retention, see `retain_expired` */
+
+    struct queue_stats __percpu *stats;
+    size_t high_water;             /* largest number of items, see `note_count` */
+    size_t stat_count;             /* number of items and capacity as of the */
+    size_t stat_capacity;          /* last change, read without locks */
+    struct dentry *stats_file;     /* <debugfs>/pqkmod/<id> */
+
+    struct mutex lock;             /* serializes everything below and `queue` */
+
+    wait_queue_head_t wait;        /* readers and pollers waiting for a change */
+    unsigned int events;           /* bumped on every change, see `wait_for_items` */
+    struct queue_notify *notify;   /* watermark eventfds, NULL when none */
+};
+
+/**
+ * State of an open file, stored in its `private_data`
+ * 
+ * Reads, writes and ioctls reach their queue through it without any lookup.
+ * The item value cached by PB2_INSERT_INT (or a 4-byte write) and the shared
+ * rings belong to the file, so that producers sharing a queue do not mix up
+ * each other's items. Accesses happen under the lock of the attached queue.
+ */
+struct queue_file {
+    struct queue_list *queue_list; /* queue the file is attached to */
+    struct queue_list *detached;   /* queue the file was created with, if it
+                                      then joined another one (PB2_ATTACH) */
 
     int32_t item_value_cache;
     int is_item_value_cached;
+
+    struct obj_ring *ring;         /* shared submission/completion rings */
+    u32 ring_entries;              /* slots per ring, private copy */
+    u32 sq_head;                   /* next submission, published to `ring` */
+    u32 cq_tail;                   /* next completion, published to `ring` */
+};
+
+#define MAX_RING_ENTRIES 32768     /* every ring's entries should be less or
+                                      equal to MAX_RING_ENTRIES */
+
+/**
+ * Priority queue sharded over several heaps, in the style of a MultiQueue
+ * 
+ * Every shard is a plain priority queue with its own lock, so that inserts
+ * and extracts on different CPUs rarely meet. Inserts go to the shard of the
+ * current CPU, spilling over to the next ones when it is full. Extracts
+ * compare the cached top priorities of `choices` random shards, which are
+ * read without locks, and pop from the best one. The order of extracted items
+ * is thus only approximate, trading priority inversions for throughput.
+ * 
+ * `count` is the total number of items; it may lag behind the shards while
+ * an operation is in progress.
+ */
+struct pq_shard {
+    struct mutex lock;             /* serializes `queue` and the tops */
+    struct priority_queue *queue;
+    int32_t min_prio;              /* priorities of the top items, 0 when */
+    int32_t max_prio;              /* empty; read without the lock */
+} ____cacheline_aligned_in_smp;
+
+struct relaxed_queue {
+    u32 shards;                    /* number of heaps */
+    u32 choices;                   /* heaps sampled per extract */
+    size_t capacity;               /* of the strict queue, split over shards */
+    atomic_t count;                /* number of items in all shards */
+    struct pq_shard shard[];
 };
 
-static struct queue_list *head;
+#define MAX_RELAXED_SHARDS 256     /* every queue's shards should be less or
+                                      equal to MAX_RELAXED_SHARDS */
+#define RELAXED_CHUNK      32      /* items moved per copy to or from userspace */
+
+static LIST_HEAD(queues);
+static atomic_t next_queue_id = ATOMIC_INIT(0);
+static DEFINE_HASHTABLE(named_queues, 6);
 
-static struct queue_list *get_queue_list      (pid_t);  
-static void              add_queue_list       (pid_t);
-static void              delete_queue_list    (pid_t);
+static struct queue_list *add_queue_list      (pid_t);
+static void              put_queue_list       (struct queue_list *);
+static void              delete_queue_list    (struct kref *);
 static void              free_queue_list      (struct queue_list *);
+static struct queue_list *find_queue_list     (const char *);
+static int               attach_queue_list    (struct queue_file *, const char *);
+static int               set_retain           (struct queue_list *, int32_t);
+static void              retain_expired       (struct work_struct *);
 
-static void              init_list            (void);
 static void              free_list            (void);
+static void              free_queue_list_rcu  (struct rcu_head *);
 static void              print_list           (void);
 
+static struct relaxed_queue *lock_queue_list   (struct queue_list *);
+static struct queue_list *lock_file_queue     (struct queue_file *, struct relaxed_queue **);
+static int               set_relaxed          (struct queue_list *, struct obj_relaxed *);
+static void              free_relaxed         (struct relaxed_queue *);
+static void              shard_changed        (struct pq_shard *);
+static struct pq_shard   *best_shard          (struct relaxed_queue *, int, u32);
+static size_t            relaxed_push         (struct queue_list *, struct relaxed_queue *, 
+                                               struct item_t *, size_t);
+static size_t            relaxed_pop          (struct queue_list *, struct relaxed_queue *, 
+                                               struct item_t *, size_t, int);
+static int               relaxed_wait         (struct file *, struct queue_list *, 
+                                               struct relaxed_queue *);
+static ssize_t           write_relaxed        (struct queue_list *, struct relaxed_queue *, 
+                                               const char *, size_t);
+static ssize_t           read_relaxed         (struct file *, struct queue_list *, 
+                                               struct relaxed_queue *, struct iov_iter *);
+static int               copy_batch_chunk     (struct item_t *, struct obj_batch *, 
+                                               size_t, size_t);
+static long              ioctl_relaxed        (struct file *, struct queue_list *, 
+                                               struct relaxed_queue *, unsigned int, 
+                                               unsigned long);
+
+static int               setup_ring           (struct queue_file *, u32);
+static int               process_ring         (struct queue_file *, struct queue_list *);
+
+static ssize_t           write_items          (struct queue_file *, struct queue_list *, 
+                                               const char *, size_t);
+static ssize_t           read_items           (struct file *, struct iov_iter *);
+static ssize_t           read_locked          (struct file *, struct queue_list *, 
+                                               struct iov_iter *);
+static long              ioctl_locked         (struct file *, struct queue_list *, 
+                                               unsigned int, unsigned long);
+static int               wait_for_items       (struct file *, struct queue_list *);
+static void              queue_changed        (struct queue_list *);
+static int               set_notify           (struct queue_list *, struct obj_notify *);
+static void              free_notify          (struct queue_notify *);
+static void              notify_count         (struct queue_list *, size_t, size_t);
+
+static void              note_count           (struct queue_list *, size_t);
+static void              note_latency         (struct queue_list *, int, u64);
+static void              collect_stats        (struct queue_list *, struct queue_stats *);
+static void              queue_size           (struct queue_list *, size_t *, size_t *);
+static void              show_histogram       (struct seq_file *, const char *, u64 *);
+static int               queue_info_show      (struct seq_file *, void *);
+static int               queue_table_show     (struct seq_file *, void *);
+
+DEFINE_SHOW_ATTRIBUTE(queue_info);
+DEFINE_SHOW_ATTRIBUTE(queue_table);
+
+static struct dentry *debugfs_dir;         /* <debugfs>/pqkmod */
+
 
 
 /* ======================== MODULE IMPLEMENTATION =========================== */
 
 
+/**
+ * @brief Create the slab caches and item array pools
+ * 
+ * @return 0 (if successful) or -ENOMEM; `destroy_caches` cleans up either way
+ */
+static int create_caches(void) {
+    static const char *item_cache_names[ITEM_CLASSES] = {
+        "pqkmod_items_64", "pqkmod_items_128", "pqkmod_items_256", "pqkmod_items_512",
+    };
+    int i;
+
+    queue_list_cache = kmem_cache_create("pqkmod_queue_list", 
+        sizeof(struct queue_list), 0, SLAB_HWCACHE_ALIGN, NULL);
+    queue_file_cache = kmem_cache_create("pqkmod_queue_file", 
+        sizeof(struct queue_file), 0, SLAB_HWCACHE_ALIGN, NULL);
+    queue_cache      = kmem_cache_create("pqkmod_queue", 
+        sizeof(struct priority_queue), 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!queue_list_cache || !queue_file_cache || !queue_cache) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < ITEM_CLASSES; i++) {
+        /* Items are copied from and to userspace in place */
+        size_t size = ((MIN_PQ_ALLOC << i) + HEAP_PAD) * sizeof(struct item_t);
+        item_caches[i] = kmem_cache_create_usercopy(item_cache_names[i], size, 0, 
+            SLAB_HWCACHE_ALIGN, 0, size, NULL);
+        if (item_caches[i] == NULL) {
+            return -ENOMEM;
+        }
+
+        item_pools[i] = mempool_create_slab_pool(ITEM_POOL_RESERVE, item_caches[i]);
+        if (item_pools[i] == NULL) {
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Destroy the slab caches and item array pools, every object must
+ * have been freed
+ */
+static void destroy_caches(void) {
+    int i;
+
+    for (i = 0; i < ITEM_CLASSES; i++) {
+        mempool_destroy(item_pools[i]);
+        kmem_cache_destroy(item_caches[i]);
+    }
+    kmem_cache_destroy(queue_cache);
+    kmem_cache_destroy(queue_file_cache);
+    kmem_cache_destroy(queue_list_cache);
+}
+
+
+/**
+ * @brief Round the size of an item array up to its size class
+ * 
+ * @param n: Number of items
+ * 
+ * @returns Number of items to allocate
+ */
+static size_t round_items(size_t n) {
+    if (n > MAX_CLASS_ITEMS) {
+        return n;
+    }
+    return n <= MIN_PQ_ALLOC ? MIN_PQ_ALLOC : roundup_pow_of_two(n);
+}
+
+
+/**
+ * @brief Allocate an item array, from the pool of its size class if any
+ * 
+ * Allocations are cache aligned and start with `HEAP_PAD` unused items, so
+ * that the children of every heap node share a cache line.
+ * 
+ * @param n: Number of items, as returned by `round_items`
+ * 
+ * @returns Pointer to the array (NULL in case of failure)
+ */
+static struct item_t *alloc_items(size_t n) {
+    struct item_t *items;
+
+    if (n <= MAX_CLASS_ITEMS) {
+        items = mempool_alloc(item_pools[ilog2(n / MIN_PQ_ALLOC)], GFP_KERNEL);
+    } else {
+        items = kvmalloc_array(n + HEAP_PAD, sizeof(struct item_t), GFP_KERNEL);
+    }
+    return items ? items + HEAP_PAD : NULL;
+}
+
+
+/**
+ * @brief Free an item array allocated by `alloc_items`
+ * 
+ * @param items: Pointer to the array
+ * @param n: Number of items it was allocated for
+ */
+static void free_items(struct item_t *items, size_t n) {
+    items -= HEAP_PAD;
+    if (n <= MAX_CLASS_ITEMS) {
+        mempool_free(items, item_pools[ilog2(n / MIN_PQ_ALLOC)]);
+    } else {
+        kvfree(items);
+    }
+}
+
+
 /**
  * @brief Allocates a priority_queue structure in memory
  * 
  * @param capacity: Maximum number of items possible
+ * @param owner: `queue_list` instance it belongs to
  * @returns Pointer to a `priority_queue` structure (NULL in case of failure)
  */
-static struct priority_queue *create_queue(size_t capacity) {
+static struct priority_queue *create_queue(size_t capacity, struct queue_list *owner) {
     struct priority_queue *queue = (struct priority_queue *) 
-        kmalloc(sizeof(struct priority_queue), GFP_KERNEL);
+        kmem_cache_alloc(queue_cache, GFP_KERNEL);
 
     /* Check if priority queue was successfully allocated */
     if (queue == NULL) {
-        printk(
+        debug_printk(
             KERN_ALERT "<create_queue@%d>: Failed to allocate a priority queue!\n", 
             current->pid
         );
         return queue;
     }
 
-    /* Initialize priority queue */
+    /* Initialize priority queue, the items array grows on demand */
+    size_t allocated = round_items(min_t(size_t, capacity, MIN_PQ_ALLOC));
     *queue = (struct priority_queue) {
-        .capacity = capacity,
-        .count    = 0,
-        .items    = (struct item_t *) 
-                        kmalloc(sizeof(struct item_t) * capacity, GFP_KERNEL),
+        .capacity  = capacity,
+        .count     = 0,
+        .allocated = allocated,
+        .owner     = owner,
+        .items     = alloc_items(allocated),
     };
 
     /* Check if the array of items was successfully allocated */
     if (queue->items == NULL) {
-        printk(
+        debug_printk(
             KERN_ALERT "<create_queue@%d>: Priority queue was allocated successfully, " \
-            "but cannot allocate array of [%d] items!\n", current->pid, capacity
+            "but cannot allocate array of [%zu] items!\n", current->pid, allocated
         );
-        kfree(queue);
+        kmem_cache_free(queue_cache, queue);
         return NULL;
     }
 
-    printk(
+    debug_printk(
         KERN_INFO "<create_queue@%d>: Successful allocation of priority queue with" \
-        " capacity [%d].\n", current->pid, capacity
+        " capacity [%zu].\n", current->pid, capacity
     );
     return queue;
 }
@@ -189,826 +770,4124 @@ static struct priority_queue *create_queue(size_t capacity) {
 static void free_queue(struct priority_queue *queue) {
     /* Null check */
     if (queue == NULL) {
-        printk(
+        debug_printk(
             KERN_ALERT "<free_queue@%d>: Attempt to deallocate null pointer.\n", 
             current->pid
         );
         return;
     }
-    kfree(queue->items);
-    kfree(queue);
-    printk(KERN_INFO "<free_queue@%d>: Successful deallocation of queue.\n", current->pid);
+    free_index(queue->index);
+    kfree(queue->radix);
+    free_buckets(queue->buckets);
+    free_arena(queue->arena);
+    free_delayed(queue->delayed);
+    free_items(queue->items, queue->allocated);
+    kmem_cache_free(queue_cache, queue);
+    debug_printk(KERN_INFO "<free_queue@%d>: Successful deallocation of queue.\n", current->pid);
 }
 
 
 /**
- * @brief Swap two items in priority queue
+ * @brief Move the items of a priority queue to an array of different size
  * 
- * @param item1: Pointer to first item
- * @param item2: Pointer to second item
+ * @param queue: Pointer to priority_queue structure
+ * @param allocated: New size of the array, at least `count`; it is rounded up
+ *                   with `round_items`
+ * 
+ * @returns 0 for success and -ENOMEM for failure (the queue is unchanged)
  */
-static void swap_items(struct item_t *item1, struct item_t *item2) {
-    struct item_t tmp = *item1;
-    *item1            = *item2;
-    *item2            = tmp;
+static int resize_items(struct priority_queue *queue, size_t allocated) {
+    allocated = round_items(allocated);
+
+    /* The index must have room for an id per item first */
+    if (queue->index && allocated > queue->index->size) {
+        int status = resize_index(queue, allocated);
+        if (status) {
+            return status;
+        }
+    }
+    /* And the buckets for the links of every slot */
+    if (queue->buckets && allocated > queue->buckets->slots) {
+        int status = resize_buckets(queue, allocated);
+        if (status) {
+            return status;
+        }
+    }
+    /* And the arena for the payload of every item */
+    if (queue->arena && allocated > queue->arena->slots) {
+        int status = resize_arena(queue, allocated);
+        if (status) {
+            return status;
+        }
+    }
+
+    struct item_t *items = alloc_items(allocated);
+    if (items == NULL) {
+        debug_printk(
+            KERN_ALERT "<resize_items@%d>: Cannot allocate array of [%zu] items!\n", 
+            current->pid, allocated
+        );
+        return -ENOMEM;
+    }
+
+    memcpy(items, queue->items, queue->count * sizeof(struct item_t));
+    free_items(queue->items, queue->allocated);
+    queue->items     = items;
+    queue->allocated = allocated;
+
+    trace_pqkmod_resize(queue->owner->id, queue->capacity, allocated, queue->count);
+    return 0;
 }
 
+
 /**
- * @brief Compare two items in the priority queue
+ * @brief Make room for items to be appended to a priority queue
  * 
- * @param item1: First item
- * @param item2: Second item
+ * The array at least doubles when it grows, so that appending items one at a
+ * time costs amortized O(1) copies each.
  * 
- * @returns  0, when item1 == item2
- *           1, when item1  > item2
- *          -1, when item1  < item2
+ * @param queue: Pointer to priority_queue structure
+ * @param n: Number of items to be stored after `items[count - 1]`
+ * 
+ * @returns Number of items that fit (less than `n` when the capacity is
+ *          reached or growing failed)
  */
-static int compare_items(struct item_t item1, struct item_t item2) {
-    return (item1.priority > item2.priority) ? 1 :
-        (item1.priority < item2.priority) ? -1 : 0;
+static size_t reserve_items(struct priority_queue *queue, size_t n) {
+    size_t room = queue->capacity - held_items(queue);
+
+    if (n > room) {
+        n = room;
+    }
+    if (queue->count + n > queue->allocated) {
+        size_t allocated = max(queue->allocated * 2, queue->count + n);
+        resize_items(queue, min(allocated, queue->capacity));
+    }
+    return min(n, queue->allocated - queue->count);
 }
 
+
 /**
- * @brief Removes the element at given index
+ * @brief Change the capacity of a priority queue, keeping its items
  * 
- * @param queue: Pointer to the priority queue where deletion is to be performed
- * @param index: Index of the item to be removed
+ * @param queue: Pointer to priority_queue structure
+ * @param capacity: New maximum number of items
  * 
- * @return 0 (for success) and -EACCES for out-of-bounds index
+ * @returns 0 for success, -EINVAL when the queue holds more than `capacity`
+ *          items (including delayed ones) and -ENOMEM when the array cannot
+ *          be shrunk
  */
-static int remove_item(struct priority_queue *queue, size_t index) {
-    if (index >= queue->count || index < 0) {
-        printk(KERN_ALERT "<remove_item@%d>: Index out-of-bounds.\n", current->pid);
-        return -EACCES;
+static int set_capacity(struct priority_queue *queue, size_t capacity) {
+    if (capacity < held_items(queue)) {
+        debug_printk(
+            KERN_ALERT "<set_capacity@%d>: Queue holds %zu items, more than the new "
+            "capacity [%zu]!\n", current->pid, held_items(queue), capacity
+        );
+        return -EINVAL;
     }
 
-    int status = decrease_prio(queue, index, 0);
-    if (status != 0) { /* decrease_prio raised an exception */
-        return status;
+    if (round_items(capacity) < queue->allocated) {
+        int status = resize_items(queue, capacity);
+        if (status) {
+            return status;
+        }
     }
+    queue->capacity = capacity;
 
-    extract_min(queue);
-
+    trace_pqkmod_resize(queue->owner->id, capacity, queue->allocated, queue->count);
     return 0;
 }
 
+
 /**
- * @brief Insert an element in a priority queue
+ * @brief Removes the element at given index
  * 
- * @param queue: Pointer to the priority queue where insertion is to be performed
- * @param item: Item to be inserted
+ * @param queue: Pointer to the priority queue where deletion is to be performed
+ * @param index: Index of the item to be removed
  * 
- * @returns 0 for success and -EACCES for failure
+ * @return 0 (for success) and -EACCES for out-of-bounds index
  */
-static int push(struct priority_queue *queue, struct item_t item) {
-    /* Check overflow */
-    if (queue->count == queue->capacity) {
-        printk(KERN_ALERT "<push@%d>: Overflow in the queue!\n", current->pid);
+static int remove_item(struct priority_queue *queue, size_t index) {
+    if (index >= queue->count) {
+        debug_printk(KERN_ALERT "<remove_item@%d>: Index out-of-bounds.\n", current->pid);
         return -EACCES;
     }
 
-    /* Push the new item in the priority queue */
-    queue->count++;
-    int index = queue->count - 1;
-    queue->items[index] = item;
+    struct item_t item = queue->items[index];
+    u32 handle = heap_handle(queue_slots(queue), index);
 
-    /* Fix priority queue property if it is violated */
-    while (index != 0 && 
-        compare_items(queue->items[PARENT(index)], queue->items[index]) > 0) {
-        swap_items(&queue->items[PARENT(index)], &queue->items[index]);
-        index = PARENT(index);
+    heap_delete(queue->items, &queue->count, index, queue_slots(queue));
+    if (queue->index) {
+        free_handle(queue->index, handle, item.value);
     }
-    printk(KERN_INFO "<push@%d>: (%d, %d) pushed to queue.\n", current->pid, 
-        item.value, item.priority);
+
+    trace_pqkmod_extract(queue->owner->id, item.value, item.priority, queue->count);
+    this_cpu_inc(queue->owner->stats->extracts);
     return 0;
 }
 
 /**
- * @brief Decrease the priority of item at given index
+ * @brief Insert an element in a priority queue
  * 
- * @param queue: Pointer to the priority queue
- * @param index: Index of the item for which priority has to be decreased
- * @param prio: New priority value for the item
+ * In an upsert queue (see `struct queue_index`), an item whose value is
+ * already queued only replaces the priority of the queued one.
  * 
- * @returns 0 (for success) and -EINVAL (for invalid arguments)
+ * @param queue: Pointer to the priority queue where insertion is to be performed
+ * @param item: Item to be inserted
+ * @param handle: Set to the item's handle in indexed queues, may be NULL
+ * 
+ * @returns 0 for success, -EACCES for overflow and -EINVAL when the engine
+ *          cannot take the priority (see `check_prio`)
  */
-static int decrease_prio(struct priority_queue *queue, size_t index, int32_t prio) {
-    /* Verify that given priority is less than priority of item at given index */
-    if (queue->items[index].priority < prio) {
-        printk(KERN_ALERT "<decrease_prio@%d>: Invalid priority given!\n", current->pid);
-        return -EINVAL;
+static int push(struct priority_queue *queue, struct item_t item, int32_t *handle) {
+    struct queue_index *index = queue->index;
+
+    if (index && index->upsert) {
+        long pos = find_value(queue, item.value);
+        if (pos >= 0) {
+            if (handle) {
+                *handle = index->hs.slots[pos];
+            }
+            return change_prio(queue, pos, item.priority);
+        }
     }
 
-    /* Change priority of the item at given index */
-    queue->items[index].priority = prio;
-
-    /* Fix priority queue property if it is violated */
-    while (index != 0 && 
-        compare_items(queue->items[PARENT(index)], queue->items[index]) > 0) {
-        swap_items(&queue->items[PARENT(index)], &queue->items[index]);
-        index = PARENT(index);
+    int status = check_prio(queue, item.priority);
+    if (status) {
+        return status;
     }
 
-    return 0;
-}
-
-/**
- * @brief Remove the minimum priority item from priority queue and return it
- * 
- * @param queue: Pointer to priority queue structure
- * 
- * @returns item value for success, -EACCES for failure
- */
-static int32_t extract_min(struct priority_queue *queue) {
-    if (queue->count == 0) {
-        printk(KERN_ALERT "<extract_min@%d>: No item to extract.\n", current->pid);
+    /* Check overflow, growing the items array if needed */
+    if (reserve_items(queue, 1) == 0) {
+        debug_printk(KERN_ALERT "<push@%d>: Overflow in the queue!\n", current->pid);
+        this_cpu_inc(queue->owner->stats->overflows);
         return -EACCES;
     }
 
-    if (queue->count == 1) {
-        queue->count = 0;
-        return queue->items[0].value;
+    if (queue->radix) {
+        radix_push(queue->radix, queue->items, &queue->count, item);
+    } else if (queue->buckets) {
+        bucket_push(queue->buckets, queue->items, &queue->count, item);
+    } else {
+        u32 new = index ? new_handle(index, item.value) : 0;
+        heap_push(queue->items, &queue->count, item, new, queue_slots(queue));
+        if (handle) {
+            *handle = new;
+        }
     }
 
-    int32_t value = queue->items[0].value;
-    queue->items[0] = queue->items[queue->count - 1];
-    queue->count--;
-    heapify(queue, 0);
-
-    return value;
+    trace_pqkmod_insert(queue->owner->id, item.value, item.priority, queue->count);
+    this_cpu_inc(queue->owner->stats->inserts);
+    note_count(queue->owner, queue->count);
+    return 0;
 }
 
 /**
- * @brief Remove the maximum priority item from priority queue and return it
- * @details This method should not be used often as getting maximum priority element
- * from a min heap is O(n)
+ * @brief Insert items that were already copied to the end of the items array
  * 
- * @param queue: Pointer to priority queue structure
+ * When the batch is at least as large as the queue it lands in, the whole
+ * heap is rebuilt bottom-up in O(count + n). Otherwise each item is sifted
+ * into place like in `push`, costing O(n log(count + n)). Indexed queues
+ * always go through `push`, which hands out handles and merges upserts.
+ * Radix queues insert each item in O(1), unless one is below the last
+ * extracted priority (the caller puts extracted items back), in which case
+ * their buckets are rebuilt. Bucket queues link each item in O(1).
  * 
- * @returns item value for success, -EACCES for failure
+ * @param queue: Pointer to the priority queue
+ * @param n: Number of items stored at `items[count .. count + n - 1]`, the
+ *           caller makes room for them with `reserve_items`
  */
-static int32_t extract_max(struct priority_queue *queue) {
-    if (queue->count == 0) {
-        printk(KERN_ALERT "<extract_max@%d>: No item to extract.\n", current->pid);
-        return -EACCES;
+static void push_appended(struct priority_queue *queue, size_t n) {
+    size_t index;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (queue->index) {
+        /* `push` writes at most up to the item it was just given */
+        size_t from = queue->count;
+        for (index = from; index < from + n; index++) {
+            push(queue, queue->items[index], NULL);
+        }
+        return;
     }
 
-    if (queue->count == 1) {
-        queue->count = 0;
-        return queue->items[0].value;
+    this_cpu_add(queue->owner->stats->inserts, n);
+    note_count(queue->owner, queue->count + n);
+
+    if (trace_pqkmod_insert_enabled()) {
+        for (index = queue->count; index < queue->count + n; index++) {
+            trace_pqkmod_insert(queue->owner->id, queue->items[index].value, 
+                queue->items[index].priority, index + 1);
+        }
     }
 
-    size_t  index = PARENT(queue->count - 1);
-    int32_t max_prio = 0;
-    size_t  max_prio_index = index;
+    if (queue->radix) {
+        struct radix_heap *rh = queue->radix;
+        size_t end = queue->count + n;
 
-    while (++index < queue->count) {
-        if (max_prio < queue->items[index].priority) {
-            max_prio = queue->items[index].priority;
-            max_prio_index = index;
+        /* Items put back after a failed copy may be below `last` */
+        for (index = queue->count; index < end; index++) {
+            if (!radix_admits(rh, queue->items[index].priority)) {
+                queue->count = end;
+                radix_build(rh, queue->items, end);
+                return;
+            }
         }
+        for (index = queue->count; index < end; index++) {
+            /* `radix_push` writes at most up to the item it was just given */
+            radix_push(rh, queue->items, &queue->count, queue->items[index]);
+        }
+        return;
     }
 
-    int32_t value = queue->items[max_prio_index].value;
+    if (queue->buckets) {
+        size_t end = queue->count + n;
+        for (index = queue->count; index < end; index++) {
+            /* Each item is linked in the slot it already sits in */
+            bucket_push(queue->buckets, queue->items, &queue->count, queue->items[index]);
+        }
+        return;
+    }
 
-    int status = remove_item(queue, max_prio_index);
-    if (status != 0) { /* remove_item raised an exception */
-        return status;
+    if (n >= queue->count) {
+        queue->count += n;
+        heap_build(queue->items, queue->count, NULL);
+        return;
     }
 
-    return value;
+    size_t end = queue->count + n;
+    for (index = queue->count; index < end; index++) {
+        /* Items before `index` form a valid heap, sift the next one in */
+        queue->count = index + 1;
+        fix_item(queue->items, queue->count, index, NULL);
+    }
 }
 
-
 /**
- * @brief A recursive method to heapify a subtree with the root at given index.
- * This method assumes that the subtrees are already heapified.
+ * @brief Put back items parked by `extract_n` that did not reach userspace
  * 
- * @param queue: Pointer to priority queue structure
- * @param index: Index to subtree to be heapified
+ * Bucket queues return them to the front of their buckets, so that items of
+ * equal priority keep their FIFO order. Indexed queues take back the handles
+ * the items had, so that the handles userspace holds stay valid: `pop_item`
+ * released them last, so they top the free list, the last extracted item's
+ * first. Other engines insert the items again.
+ * 
+ * @param queue: Pointer to the priority queue
+ * @param n: Number of items stored at `items[count .. count + n - 1]`, the
+ *           last ones extracted, in extraction order
  */
-static void heapify(struct priority_queue *queue, size_t index) {
-    size_t l_index = LCHILD(index);
-    size_t r_index = RCHILD(index);
-
-    /* `pos` points to item having maximum priority among `index`, `l_index` 
-        and `r_index` */
-    size_t pos = index;
-
-    if (l_index < queue->count && 
-        compare_items(queue->items[l_index], queue->items[pos]) < 0) {
-        pos = l_index;
-    }
-    if (r_index < queue->count && 
-        compare_items(queue->items[r_index], queue->items[pos]) < 0) {
-        pos = r_index;
+static void restore_items(struct priority_queue *queue, size_t n) {
+    struct queue_index *index = queue->index;
+    size_t i;
+
+    if (index) {
+        /* Parked positions are free, their slots hold the handles meanwhile */
+        for (i = n; i-- > 0; ) {
+            u32 handle = index->free;
+            u32 id     = handle & HEAP_ID_MASK;
+
+            index->free = index->hs.positions[id];
+            index->hs.slots[queue->count + i] = handle;
+            if (index->upsert) {
+                u32 hash = hash_32(queue->items[queue->count + i].value, index->bits);
+                index->chain[id] = index->buckets[hash];
+                index->buckets[hash] = id;
+            }
+        }
+        /* `heap_push` writes at most up to the item it was just given */
+        size_t from = queue->count;
+        for (i = from; i < from + n; i++) {
+            heap_push(queue->items, &queue->count, queue->items[i], 
+                index->hs.slots[i], &index->hs);
+        }
+        this_cpu_add(queue->owner->stats->inserts, n);
+        return;
     }
 
-    if (pos != index) {
-        swap_items(&queue->items[index], &queue->items[pos]);
-        heapify(queue, pos);
+    if (queue->buckets == NULL) {
+        push_appended(queue, n);
+        return;
     }
-}
 
+    this_cpu_add(queue->owner->stats->inserts, n);
+    bucket_restore(queue->buckets, queue->items, &queue->count, n);
+}
 
 /**
- * @brief Fetch the priority queue for given process
+ * @brief Check that the engine of a priority queue can take a priority,
+ * which the caller already checked to be positive
  * 
- * @param pid: pid of the process
+ * @param queue: Pointer to the priority queue
+ * @param prio: Priority of an item to be inserted
  * 
- * @return `queue_list` instance holding priority queue
+ * @returns 0 when it can, -EINVAL when a radix queue extracted a higher
+ *          priority already or the priority is beyond a bucket queue's range
  */
-static struct queue_list *get_queue_list(pid_t pid) {
-    mutex_lock(&qlock);
-
-    struct queue_list *queue_list = head->next;
-    while (queue_list != NULL) {
-        if (queue_list->pid == pid) {
-            printk(KERN_INFO "<get_queue@%d>: Successfully found the queue.\n", pid);
-            mutex_unlock(&qlock);
-            return queue_list;
-        }
-        queue_list = queue_list->next;
+static int check_prio(struct priority_queue *queue, int32_t prio) {
+    if (queue->radix && !radix_admits(queue->radix, prio)) {
+        debug_printk(
+            KERN_ALERT "<check_prio@%d>: Priority %d is below the last extracted one [%u]!\n", 
+            current->pid, prio, queue->radix->last
+        );
+        return -EINVAL;
     }
-    printk(KERN_ALERT "<get_queue@%d>: No queue found!\n", pid);
-
-    mutex_unlock(&qlock);
-    return queue_list;
+    if (queue->buckets && prio > queue->buckets->range) {
+        debug_printk(
+            KERN_ALERT "<check_prio@%d>: Priority %d is beyond the bucket range [1, %u]!\n", 
+            current->pid, prio, queue->buckets->range
+        );
+        return -EINVAL;
+    }
+    return 0;
 }
 
-
 /**
- * @brief Allocate and add priority queue for given process in the linked list 
+ * @brief Change the priority of item at given index, in either direction
  * 
- * @param pid: pid of the process
+ * @param queue: Pointer to the priority queue
+ * @param index: Index of the item
+ * @param prio: New priority value for the item
+ * 
+ * @returns 0 (for success) and -EACCES for out-of-bounds index
  */
-static void add_queue_list(pid_t pid) {
-    mutex_lock(&qlock);
+static int change_prio(struct priority_queue *queue, size_t index, int32_t prio) {
+    if (index >= queue->count) {
+        debug_printk(KERN_ALERT "<change_prio@%d>: Index out-of-bounds.\n", current->pid);
+        return -EACCES;
+    }
 
-    struct queue_list *queue_list = (struct queue_list *) 
-        kmalloc(sizeof(struct queue_list), GFP_KERNEL);
-    *queue_list = (struct queue_list) {
-        .pid                  = pid,
-        .queue                = NULL,
-        .next                 = NULL,
-        .item_value_cache     = 0,
-        .is_item_value_cached = 0,
-    };
+    /* Change priority of the item at given index */
+    queue->items[index].priority = prio;
 
-    queue_list->next = head->next;
-    head->next = queue_list;
-    printk(KERN_INFO "<add_queue@%d>: Successfully added the queue.\n", pid);
+    /* Fix priority queue property if it is violated */
+    fix_item(queue->items, queue->count, index, queue_slots(queue));
 
-    mutex_unlock(&qlock);
+    return 0;
 }
 
-
 /**
- * @brief Deallocate priority queue for given process
+ * @brief Get the minimum priority item without removing it
  * 
- * @param pid: pid of the process
+ * @param queue: Pointer to priority queue structure
+ * 
+ * @returns Pointer to the item (NULL when the queue is empty)
  */
-static void delete_queue_list(pid_t pid) {
-    mutex_lock(&qlock);
-
-    struct queue_list *prv = head;
-    struct queue_list *cur = head->next;
-
-    while (cur != NULL) {
-        if (cur->pid == pid) {
-            prv->next = cur->next;
-            free_queue_list(cur);
-            printk(KERN_INFO "<delete_queue@%d>: Successfully deleted the queue.\n", pid);
-            mutex_unlock(&qlock);
-            return;
-        }
-        prv = cur;
-        cur = cur->next;
+static struct item_t *peek_min(struct priority_queue *queue) {
+    if (queue->count == 0) {
+        return NULL;
     }
-    printk(KERN_ALERT "<delete_queue@%d>: No queue found!\n", pid);
-
-    mutex_unlock(&qlock);
+    if (queue->radix) {
+        return &queue->items[radix_min_index(queue->radix, queue->items, queue->count)];
+    }
+    if (queue->buckets) {
+        return &queue->items[bucket_first(queue->buckets, 0)];
+    }
+    return &queue->items[0];
 }
 
-
 /**
- * @brief Internal helper subroutine for `delete_queue_list`.
+ * @brief Get the maximum priority item without removing it
+ * 
+ * @param queue: Pointer to priority queue structure, not a radix one
+ * 
+ * @returns Pointer to the item (NULL when the queue is empty)
  */
-static void free_queue_list(struct queue_list *queue_list) {
-    /* No mutex lock and unlock as this is an internal helper subroutine */
-    if (queue_list == NULL) {
-        printk(KERN_ALERT "<free_queue_list@%d>: Attempt to deallocate null pointer!\n", current->pid);
-        return;
+static struct item_t *peek_max(struct priority_queue *queue) {
+    if (queue->count == 0) {
+        return NULL;
     }
-    free_queue(queue_list->queue);
-    printk(KERN_INFO "<free_queue_list@%d>: Deallocated the queue.\n", queue_list->pid);
-    kfree(queue_list);
+    if (queue->buckets) {
+        return &queue->items[bucket_first(queue->buckets, 1)];
+    }
+    return &queue->items[heap_max_index(queue->items, queue->count)];
 }
 
-
 /**
- * @brief Allocates head of linked list containing priority queues. It is an
- * internal helper subroutine used by `module_init`.
+ * @brief Remove the minimum or maximum priority item, releasing its handle
+ * 
+ * @param queue: Pointer to a non-empty priority queue
+ * @param max: Remove the maximum when non-zero (never for radix queues), the
+ *             minimum otherwise
+ * 
+ * @returns The removed item
  */
-static void init_list(void) {
-    head = (struct queue_list *) kmalloc(sizeof(struct queue_list), GFP_KERNEL);
-    *head = (struct queue_list) {
-        .pid                  = -1,
-        .queue                = NULL,
-        .next                 = NULL,
-        .item_value_cache     = 0,
-        .is_item_value_cached = 0,
-    };
-    printk(KERN_INFO "<init_list>: Head of queue list allocated.");
-}
+static struct item_t pop_item(struct priority_queue *queue, int max) {
+    if (queue->radix) {
+        return radix_pop(queue->radix, queue->items, &queue->count);
+    }
+    if (queue->buckets) {
+        return bucket_pop(queue->buckets, queue->items, &queue->count, max);
+    }
 
+    size_t index = max ? heap_max_index(queue->items, queue->count) : 0;
+    struct heap_slots *hs = queue_slots(queue);
+    u32 handle = heap_handle(hs, index);
+
+    struct item_t item = heap_pop(queue->items, &queue->count, index, hs);
+    if (hs) {
+        free_handle(queue->index, handle, item.value);
+    }
+    return item;
+}
 
 /**
- * @brief Deallocates entire linked list of priority queues. It is an 
- * internal helper subroutine used by `module_exit`.
+ * @brief Remove the minimum priority item from priority queue and return it
+ * 
+ * @param queue: Pointer to priority queue structure
+ * 
+ * @returns item value for success, -EACCES for failure
  */
-static void free_list(void) {
-    struct queue_list *p, *q;
-    q = head->next;
-    free_queue_list(head);
-    while (q != NULL) {
-        p = q;
-        q = q->next;
-        free_queue_list(p);
+static int32_t extract_min(struct priority_queue *queue) {
+    if (queue->count == 0) {
+        debug_printk(KERN_ALERT "<extract_min@%d>: No item to extract.\n", current->pid);
+        this_cpu_inc(queue->owner->stats->underflows);
+        return -EACCES;
     }
-    printk(KERN_INFO "<free_list>: Deallocated all the queues.\n");
-}
 
+    struct item_t item = pop_item(queue, 0);
+    trace_pqkmod_extract(queue->owner->id, item.value, item.priority, queue->count);
+    this_cpu_inc(queue->owner->stats->extracts);
+
+    return item.value;
+}
 
 /**
- * @brief Prints pid of processes for which priority queue is stil alive.
+ * @brief Remove the maximum priority item from priority queue and return it
+ * 
+ * @param queue: Pointer to priority queue structure, not a radix one
+ * 
+ * @returns item value for success, -EACCES for failure
  */
-static void print_list(void) {
-    mutex_lock(&qlock);
-
-    struct queue_list *q = head->next;
-    printk(KERN_INFO "<print_queue_list>: [");
-    while (q != NULL) {
-        printk("%d, ", q->pid);
-        q = q->next;
+static int32_t extract_max(struct priority_queue *queue) {
+    if (queue->count == 0) {
+        debug_printk(KERN_ALERT "<extract_max@%d>: No item to extract.\n", current->pid);
+        this_cpu_inc(queue->owner->stats->underflows);
+        return -EACCES;
     }
-    printk("]\n");
 
-    mutex_unlock(&qlock);
-}
+    struct item_t item = pop_item(queue, 1);
+    trace_pqkmod_extract(queue->owner->id, item.value, item.priority, queue->count);
+    this_cpu_inc(queue->owner->stats->extracts);
 
+    return item.value;
+}
 
 
 /**
- * @brief Write data to priority queue
+ * @brief Remove up to `n` minimum (or maximum) priority items at once
  * 
- * @return Number of bytes wrote (if successful)
- *         -EACCES
- *             - when no queue_list is associated with given process
- *             - priority queue overflow
- *         -EINVAL
- *             - invalid input type for item value/priority
- *             - invalid buffer length
- *             - out of range queue size
- *         -ENOMEM
- *             - queue allocation failed
+ * Every extraction frees the last slot of the items array, so the extracted
+ * items are parked in those slots. On return they are stored in extraction
+ * order at `items[count .. count + ret - 1]`, where they stay valid until the
+ * next insertion. This lets callers copy them out with a single copy_to_user,
+ * or hand them back to `push_appended` if that copy fails.
+ * 
+ * @param queue: Pointer to priority queue structure
+ * @param n: Maximum number of items to extract
+ * @param max: Extract maximum priority items when non-zero (never for radix
+ *             queues), minimum otherwise
+ * 
+ * @returns Number of items extracted
  */
-static ssize_t qwrite(struct file *file, const char *buf, size_t count, loff_t *pos) {
-    if (!buf || !count) return -EINVAL; /* check buf is not null and count is non-zero */
+static size_t extract_n(struct priority_queue *queue, size_t n, int max) {
+    size_t end = queue->count;
+    size_t done, index;
 
-    /* Get the associated queue_list for current process */
-    struct queue_list *queue_list = get_queue_list(current->pid);
-    if (queue_list == NULL) {
-        /* No queue_list associated with current process */
-        printk(
-            KERN_ALERT DEVICE_NAME " <write@%d>: No file associated with "
-            "current process!\n", current->pid
-        );
-        return -EACCES;
-    }
+    for (done = 0; done < n && queue->count > 0; done++) {
+        struct item_t item = pop_item(queue, max);
+        queue->items[queue->count] = item;
 
-    int buf_len = count < 256 ? count : 256;
+        trace_pqkmod_extract(queue->owner->id, item.value, item.priority, queue->count);
+    }
 
-    if (queue_list->queue != NULL) {
-        /**
-         * `queue_list` is already initialized. Hence, need to write an integer
-         * (4-bytes). It may be item's value or priority. We distinguish the two
-         * cases using `item_value_cache` and `is_item_value_cached`.
-         */
+    this_cpu_add(queue->owner->stats->extracts, done);
 
-        /* Check if received an integer (4-bytes)? */
-        if (buf_len != 4) {
-            printk(
-                KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, "
-                "expected an integer (4 bytes)!\n", current->pid
-            );
-            return -EINVAL;
-        }
+    /* Slots were filled from the back, reverse them into extraction order */
+    for (index = 0; index < done / 2; index++) {
+        swap_items(&queue->items[queue->count + index], &queue->items[end - 1 - index]);
+    }
 
-        int32_t num;
-        memcpy(&num, buf, sizeof(char) * buf_len);
-        printk(KERN_INFO DEVICE_NAME " <write@%d>: Received %d.\n", current->pid, num);
+    return done;
+}
 
-        if (queue_list->is_item_value_cached) {
-            /* `num` will be treated as priority for cached item value */
 
-            /* Check if `num` > 0 as priority is a positive integer */
-            if (num <= 0) {
-                printk(
-                    KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, "
-                    "priority must be a positive integer!\n", current->pid
+/**
+ * @brief Select the engine of a newly created, empty priority queue
+ * 
+ * @param queue: Pointer to priority queue structure
+ * @param engine: One of PB2_ENGINE_*
+ * @param range: Highest priority of a bucket queue, ignored otherwise
+ * 
+ * @returns 0 for success, -EINVAL for an unknown engine or a range out of
+ *          [1, BUCKET_MAX_RANGE] and -ENOMEM for failure
+ */
+static int set_engine(struct priority_queue *queue, int32_t engine, int32_t range) {
+    struct bucket_queue *bq;
+
+    switch (engine) {
+        case PB2_ENGINE_HEAP:
+            return 0;
+
+        case PB2_ENGINE_RADIX:
+            queue->radix = kzalloc(sizeof(*queue->radix), GFP_KERNEL);
+            return queue->radix ? 0 : -ENOMEM;
+
+        case PB2_ENGINE_BUCKET:
+            BUILD_BUG_ON(PB2_BUCKET_MAX_RANGE != BUCKET_MAX_RANGE);
+            if (range <= 0 || range > BUCKET_MAX_RANGE) {
+                debug_printk(
+                    KERN_ALERT "<set_engine@%d>: Bucket range should be in [1, %d], "
+                    "got %d!\n", current->pid, BUCKET_MAX_RANGE, range
                 );
                 return -EINVAL;
             }
 
-            /* Prepare item to push to priority queue */
-            struct item_t new_item = (struct item_t) {
-                .value    = queue_list->item_value_cache,
-                .priority = num,
-            };
-
-            int status = push(queue_list->queue, new_item);
-            if (status < 0) {
-                /* Overflow in priority queue */
-                return status;
+            bq = kzalloc(sizeof(*bq), GFP_KERNEL);
+            if (bq == NULL) {
+                return -ENOMEM;
             }
+            bq->range = range;
+            bq->head  = kvmalloc_array(range, sizeof(u32), GFP_KERNEL);
+            bq->tail  = kvmalloc_array(range, sizeof(u32), GFP_KERNEL);
+            queue->buckets = bq;
+            if (bq->head == NULL || bq->tail == NULL || resize_buckets(queue, queue->allocated)) {
+                queue->buckets = NULL;
+                free_buckets(bq);
+                return -ENOMEM;
+            }
+            bucket_reset(bq);
+            return 0;
 
-            printk(KERN_INFO DEVICE_NAME " <write@%d>: Item inserted in queue.\n", current->pid);
-            queue_list->is_item_value_cached = 0;
-        } else {
-            /* `num` is treated as item value and will be cached for the process */
-            queue_list->item_value_cache = num;
-            queue_list->is_item_value_cached = 1;
-            printk(
-                KERN_INFO DEVICE_NAME " <write@%d>: Item value cached, waiting for "
-                "item priority.\n", current->pid
-            );
-        }
-
-        return sizeof(num);
+        default:
+            debug_printk(KERN_ALERT "<set_engine@%d>: Unknown engine %d!\n", 
+                current->pid, engine);
+            return -EINVAL;
     }
+}
 
-    /* `queue_list` for current process is not initialized */
-
-    /* Check if received only one byte of data */
-    if (buf_len != 1) {
-        printk(
-            KERN_ALERT DEVICE_NAME "<write@%d>: Expected one byte of data, "
-            "got %d byte(s)!\n", current->pid, buf_len
+/**
+ * @brief Grow the per-slot links of a bucket queue
+ * 
+ * @param queue: Pointer to a bucket priority queue
+ * @param slots: Number of slots the links must cover
+ * 
+ * @returns 0 for success and -ENOMEM for failure (the links are unchanged)
+ */
+static int resize_buckets(struct priority_queue *queue, size_t slots) {
+    struct bucket_queue *bq = queue->buckets;
+    u32 *next = kvmalloc_array(slots, sizeof(u32), GFP_KERNEL);
+    u32 *prev = kvmalloc_array(slots, sizeof(u32), GFP_KERNEL);
+
+    if (next == NULL || prev == NULL) {
+        debug_printk(
+            KERN_ALERT "<resize_buckets@%d>: Cannot allocate links of [%zu] slots!\n", 
+            current->pid, slots
         );
-        return -EINVAL;
+        kvfree(next);
+        kvfree(prev);
+        return -ENOMEM;
     }
 
-    size_t queue_size = buf[0];
-    /* Check if `queue_size` is in valid range */
-
-    if (!(queue_size > 0 && queue_size <= MAX_PQ_CAPACITY)) {
-        printk(
-            KERN_ALERT DEVICE_NAME "<write@%d>: Priority-queue size "
-            "should be in range [1, 100], got %d!", current->pid, queue_size
-        );
-        return -EINVAL;
+    if (bq->slots > 0) {
+        memcpy(next, bq->next, queue->count * sizeof(u32));
+        memcpy(prev, bq->prev, queue->count * sizeof(u32));
     }
+    kvfree(bq->next);
+    kvfree(bq->prev);
+    bq->next  = next;
+    bq->prev  = prev;
+    bq->slots = slots;
+    return 0;
+}
 
-    /* Allocate priority queue for current process */
-    queue_list->queue = create_queue(queue_size);
-    if (queue_list->queue == NULL) {
-        /* Error will be reported in `create_queue` method */
-        return -ENOMEM;
+/**
+ * @brief Deallocate the state of a bucket queue
+ * 
+ * @param bq: Pointer to bucket_queue structure, may be NULL
+ */
+static void free_buckets(struct bucket_queue *bq) {
+    if (bq == NULL) {
+        return;
     }
-    
-    return buf_len;
+    kvfree(bq->head);
+    kvfree(bq->tail);
+    kvfree(bq->next);
+    kvfree(bq->prev);
+    kfree(bq);
 }
 
 
 /**
- * @brief Read value of highest priority item from current process's queue and extract_min it
+ * @brief Start or stop tracking the items of an empty priority queue by handle
  * 
- * @return Number of bytes read (if successful)
- *         -EINVAL
- *             - when number of bytes requested for reading is not 4 (bytes)
- *         -EACCES
- *             - when no queue is associated with current process
- *             - when priority queue is not initialized for current process
- *             - priority queue underflow
- *             - unable to copy item value to buffer `buf`
+ * @param queue: Pointer to priority queue structure
+ * @param upsert: Merge insertions of a value that is already queued
+ * 
+ * @returns 0 for success, -EBUSY when the queue is not empty, already
+ *          indexed, carries payloads or is not a heap and -ENOMEM for failure
  */
-static ssize_t qread(struct file *file, char *buf, size_t count, loff_t *pos) {
-    /* Check if count is non 4 (bytes) */
-    if (count != 4) return -EINVAL;
-
-    /* Fetch priority queue for current process */
-    struct queue_list *queue_list = get_queue_list(current->pid);
-    if (queue_list == NULL) {
-        printk(
-            KERN_ALERT DEVICE_NAME " <read@%d>: No queue associated with "
-            "current process!\n", current->pid
-        );
-        return -EACCES;
-    }
-
-    if (queue_list->queue == NULL) {
-        printk(
-            KERN_ALERT DEVICE_NAME " <read@%d>: Priority queue is not "
-            "initialized!\n", current->pid
+static int set_indexed(struct priority_queue *queue, bool upsert) {
+    if (queue->count > 0 || queue->index || queue->arena || !is_heap(queue)) {
+        debug_printk(
+            KERN_ALERT "<set_indexed@%d>: Queue must be an empty, not indexed heap!\n", 
+            current->pid
         );
-        return -EACCES;
+        return -EBUSY;
     }
 
-    if (queue_list->queue->count == 0) {
-        printk(
-            KERN_ALERT DEVICE_NAME " <read@%d>: No item present in priority "
-            "queue!\n", current->pid
-        );
-        return -EACCES;
+    struct queue_index *index = kzalloc(sizeof(*index), GFP_KERNEL);
+    if (index == NULL) {
+        return -ENOMEM;
     }
-
-    int32_t item_value = extract_min(queue_list->queue);
-    int status = copy_to_user(buf, (int32_t *)(&item_value), count);
-
-    if (status < 0) {
-        /* `copy_to_user` failed */
-        printk(
-            KERN_ALERT DEVICE_NAME " <read@%d>: copy_to_user failed!\n", 
-            current->pid
-        );
-        return -EACCES;
+    index->free   = NO_ID;
+    index->upsert = upsert;
+
+    queue->index = index;
+    int status = resize_index(queue, queue->allocated);
+    if (status) {
+        queue->index = NULL;
+        kfree(index);
     }
-
-    return sizeof(item_value);
+    return status;
 }
 
-
 /**
- * @brief Allocates a new `queue_list` instance for current process (if it 
- * doesn't exist)
+ * @brief Grow the arrays of the index of a priority queue
  * 
- * @return 0 (if successful)
- *         -EACCES
- *             - when current process already has a queue
+ * The buckets of upsert queues are rehashed to about one per id.
+ * 
+ * @param queue: Pointer to an indexed priority queue
+ * @param size: Number of ids the arrays must hold
+ * 
+ * @returns 0 for success and -ENOMEM for failure (the index is unchanged)
  */
-static int qopen(struct inode *inode, struct file *file) {
-    /**
-     * If current process has already opened the file, don't allocate a new 
-     * `queue_list` instance
-     */
-    if (get_queue_list(current->pid) != NULL) {
-        printk(
-            KERN_ALERT DEVICE_NAME " <open@%d>: Current process already "
-            "has an associated queue!\n", current->pid
+static int resize_index(struct priority_queue *queue, size_t size) {
+    struct queue_index *index = queue->index;
+    u32 *slots     = kvmalloc_array(size, sizeof(u32), GFP_KERNEL);
+    u32 *positions = kvmalloc_array(size, sizeof(u32), GFP_KERNEL);
+    u32 *chain = NULL, *buckets = NULL;
+    u32 bits = ilog2(roundup_pow_of_two(size));
+    size_t i;
+
+    if (index->upsert) {
+        chain   = kvmalloc_array(size, sizeof(u32), GFP_KERNEL);
+        buckets = kvmalloc_array(1UL << bits, sizeof(u32), GFP_KERNEL);
+    }
+    if (slots == NULL || positions == NULL || (index->upsert && (chain == NULL || buckets == NULL))) {
+        debug_printk(
+            KERN_ALERT "<resize_index@%d>: Cannot allocate index of [%zu] ids!\n", 
+            current->pid, size
         );
-        return -EACCES;
+        kvfree(slots);
+        kvfree(positions);
+        kvfree(chain);
+        kvfree(buckets);
+        return -ENOMEM;
     }
 
-    add_queue_list(current->pid);
-    print_list();
+    if (index->size > 0) {
+        memcpy(slots, index->hs.slots, queue->count * sizeof(u32));
+        memcpy(positions, index->hs.positions, index->ids * sizeof(u32));
+    }
+    kvfree(index->hs.slots);
+    kvfree(index->hs.positions);
+    index->hs.slots     = slots;
+    index->hs.positions = positions;
+    index->size         = size;
+
+    if (index->upsert) {
+        kvfree(index->chain);
+        kvfree(index->buckets);
+        index->chain   = chain;
+        index->buckets = buckets;
+        index->bits    = bits;
+
+        memset(buckets, 0xff, (1UL << bits) * sizeof(u32));
+        for (i = 0; i < queue->count; i++) {
+            u32 id = slots[i] & HEAP_ID_MASK;
+            u32 hash = hash_32(queue->items[i].value, bits);
+            chain[id] = buckets[hash];
+            buckets[hash] = id;
+        }
+    }
     return 0;
 }
 
-
 /**
- * @brief Deallocates priority queue for current process
+ * @brief Deallocate the index of a priority queue
+ * 
+ * @param index: Pointer to queue_index structure, may be NULL
  */
-static int qrelease(struct inode *inode, struct file *file) {
-    delete_queue_list(current->pid);
-    print_list();
-    return 0;
+static void free_index(struct queue_index *index) {
+    if (index == NULL) {
+        return;
+    }
+    kvfree(index->hs.slots);
+    kvfree(index->hs.positions);
+    kvfree(index->chain);
+    kvfree(index->buckets);
+    kfree(index);
 }
 
-
 /**
- * @brief Support for ioctl calls to manipulate priority queue
+ * @brief Hand out the handle of an item about to be inserted
+ * 
+ * @param index: Index of a priority queue with room for one more item
+ * @param value: Value of the item
+ * 
+ * @returns The handle, to be stored with the item by the heap routines
  */
-static long qioctl(struct file *file, unsigned int cmd, unsigned long arg) {
-    /* Fetch priority queue for current process */
-    struct queue_list *queue_list = get_queue_list(current->pid);
-    if (queue_list == NULL) {
-        /* No queue_list associated with current process */
-        printk(
-            KERN_ALERT DEVICE_NAME " <qioctl@%d>: No file associated with "
-            "current process!\n", current->pid
+static u32 new_handle(struct queue_index *index, int32_t value) {
+    u32 id, generation = 0;
+
+    if (index->free != NO_ID) {
+        id          = index->free & HEAP_ID_MASK;
+        generation  = (index->free >> HEAP_ID_BITS) + 1;
+        index->free = index->hs.positions[id];
+    } else {
+        id = index->ids++;
+    }
+
+    if (index->upsert) {
+        u32 hash = hash_32(value, index->bits);
+        index->chain[id] = index->buckets[hash];
+        index->buckets[hash] = id;
+    }
+
+    return id | (generation & HANDLE_GENERATIONS) << HEAP_ID_BITS;
+}
+
+/**
+ * @brief Recycle the handle of an item that left the heap
+ * 
+ * @param index: Index of a priority queue
+ * @param handle: Handle of the item
+ * @param value: Value of the item
+ */
+static void free_handle(struct queue_index *index, u32 handle, int32_t value) {
+    u32 id = handle & HEAP_ID_MASK;
+
+    if (index->upsert) {
+        u32 *link = &index->buckets[hash_32(value, index->bits)];
+        while (*link != id) {
+            link = &index->chain[*link];
+        }
+        *link = index->chain[id];
+    }
+
+    index->hs.positions[id] = index->free;
+    index->free = handle;
+}
+
+/**
+ * @brief Find the item of a handle
+ * 
+ * @param queue: Pointer to an indexed priority queue
+ * @param handle: Handle returned by PB2_INSERT_HANDLE
+ * 
+ * @returns Index of the item, -EINVAL when it is no longer queued
+ */
+static long find_handle(struct priority_queue *queue, int32_t handle) {
+    struct queue_index *index = queue->index;
+
+    if (handle < 0 || (handle & HEAP_ID_MASK) >= index->ids) {
+        return -EINVAL;
+    }
+
+    /* Released ids hold list links, which the slot check tells apart */
+    u32 pos = index->hs.positions[handle & HEAP_ID_MASK];
+    if (pos >= queue->count || index->hs.slots[pos] != handle) {
+        return -EINVAL;
+    }
+    return pos;
+}
+
+/**
+ * @brief Find the item of a value in an upsert queue
+ * 
+ * @param queue: Pointer to a priority queue indexed in upsert mode
+ * @param value: Value of the item
+ * 
+ * @returns Index of the item, -EINVAL when no item has that value
+ */
+static long find_value(struct priority_queue *queue, int32_t value) {
+    struct queue_index *index = queue->index;
+    u32 id;
+
+    for (id = index->buckets[hash_32(value, index->bits)]; id != NO_ID; id = index->chain[id]) {
+        u32 pos = index->hs.positions[id];
+        if (queue->items[pos].value == value) {
+            return pos;
+        }
+    }
+    return -EINVAL;
+}
+
+
+/**
+ * @brief Let the items of an empty priority queue carry payloads
+ * 
+ * @param queue: Pointer to priority queue structure
+ * @param size: Maximum bytes of data per item
+ * 
+ * @returns 0 for success, -EINVAL for a size out of [1, PB2_MAX_PAYLOAD],
+ *          -EBUSY when the queue is not empty, already carries payloads or
+ *          is indexed and -ENOMEM for failure
+ */
+static int set_payload(struct priority_queue *queue, int32_t size) {
+    if (size <= 0 || size > PB2_MAX_PAYLOAD) {
+        debug_printk(
+            KERN_ALERT "<set_payload@%d>: Payload size should be in [1, %d], got %d!\n", 
+            current->pid, PB2_MAX_PAYLOAD, size
+        );
+        return -EINVAL;
+    }
+    if (queue->count > 0 || queue->arena || queue->index) {
+        debug_printk(
+            KERN_ALERT "<set_payload@%d>: Queue must be empty, without payloads "
+            "or handles!\n", current->pid
+        );
+        return -EBUSY;
+    }
+
+    struct payload_arena *arena = kzalloc(sizeof(*arena), GFP_KERNEL);
+    if (arena == NULL) {
+        return -ENOMEM;
+    }
+    arena->size   = size;
+    arena->stride = ALIGN(sizeof(struct obj_payload) + size, 8);
+    arena->free   = NO_ID;
+
+    queue->arena = arena;
+    int status = resize_arena(queue, queue->allocated);
+    if (status) {
+        queue->arena = NULL;
+        kfree(arena);
+    }
+    return status;
+}
+
+/**
+ * @brief Grow the arena of a priority queue
+ * 
+ * @param queue: Pointer to a priority queue carrying payloads
+ * @param slots: Number of slots the arena must hold
+ * 
+ * @returns 0 for success and -ENOMEM for failure (the arena is unchanged)
+ */
+static int resize_arena(struct priority_queue *queue, size_t slots) {
+    struct payload_arena *arena = queue->arena;
+    u8 *data = kvmalloc_array(slots, arena->stride, GFP_KERNEL);
+
+    if (data == NULL) {
+        debug_printk(
+            KERN_ALERT "<resize_arena@%d>: Cannot allocate arena of [%zu] slots!\n", 
+            current->pid, slots
+        );
+        return -ENOMEM;
+    }
+
+    if (arena->slots > 0) {
+        memcpy(data, arena->data, (size_t) arena->ids * arena->stride);
+    }
+    kvfree(arena->data);
+    arena->data  = data;
+    arena->slots = slots;
+    return 0;
+}
+
+/**
+ * @brief Deallocate the arena of a priority queue
+ * 
+ * @param arena: Pointer to payload_arena structure, may be NULL
+ */
+static void free_arena(struct payload_arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    kvfree(arena->data);
+    kfree(arena);
+}
+
+/**
+ * @brief Insert a record from userspace into a priority queue carrying
+ * payloads. Its data is copied straight into a free slot of the arena.
+ * 
+ * @param queue: Pointer to a priority queue carrying payloads
+ * @param record: Userspace address of a `struct obj_payload` and its data
+ * 
+ * @returns 0 for success, -EACCES for overflow and -EINVAL for a bad record
+ *          or a failed copy
+ */
+static int push_payload(struct priority_queue *queue, struct obj_payload *record) {
+    struct payload_arena *arena = queue->arena;
+    struct obj_payload header;
+
+    if (copy_from_user(&header, record, sizeof(header))) {
+        return -EINVAL;
+    }
+    if (header.priority <= 0 || header.size < 0 || header.size > arena->size) {
+        debug_printk(
+            KERN_ALERT "<push_payload@%d>: Invalid argument, priority must be a "
+            "positive integer and size in [0, %u]!\n", current->pid, arena->size
+        );
+        return -EINVAL;
+    }
+    if (check_prio(queue, header.priority)) {
+        /* Error will be reported in `check_prio` method */
+        return -EINVAL;
+    }
+
+    /* Every item holds a slot, so a free one exists once there is room */
+    if (reserve_items(queue, 1) == 0) {
+        debug_printk(KERN_ALERT "<push_payload@%d>: Overflow in the queue!\n", current->pid);
+        this_cpu_inc(queue->owner->stats->overflows);
+        return -EACCES;
+    }
+
+    u32 id = arena->free != NO_ID ? arena->free : arena->ids;
+    struct obj_payload *slot = arena_slot(arena, id);
+    u32 next = slot->value;
+
+    if (copy_from_user(slot->data, record->data, header.size)) {
+        return -EINVAL;
+    }
+    if (id == arena->ids) {
+        arena->ids++;
+    } else {
+        arena->free = next;
+    }
+    *slot = header;
+
+    return push(queue, (struct item_t) { .value = id, .priority = header.priority }, NULL);
+}
+
+/**
+ * @brief Extract the minimum or maximum priority item of a priority queue
+ * carrying payloads, and copy its whole record to userspace at once
+ * 
+ * @param queue: Pointer to a non-empty priority queue carrying payloads
+ * @param max: Extract the maximum when non-zero (never for radix queues),
+ *             the minimum otherwise
+ * @param record: Userspace buffer with room for a `struct obj_payload` and
+ *                the queue's payload size
+ * 
+ * @returns 0 for success and -EINVAL when the copy fails (the item stays
+ *          queued)
+ */
+static int pop_payload(struct priority_queue *queue, int max, struct obj_payload *record) {
+    struct payload_arena *arena = queue->arena;
+
+    extract_n(queue, 1, max);
+    u32 id = queue->items[queue->count].value;
+    struct obj_payload *slot = arena_slot(arena, id);
+
+    if (copy_to_user(record, slot, sizeof(*slot) + slot->size)) {
+        restore_items(queue, 1);
+        return -EINVAL;
+    }
+
+    slot->value = arena->free;
+    arena->free = id;
+    return 0;
+}
+
+
+/* Move the item at `index` of a delay heap up or down into place */
+static void delay_sift_up(struct delayed_item *heap, size_t index) {
+    struct delayed_item hole = heap[index];
+
+    while (index > 0 && heap[(index - 1) / 2].due > hole.due) {
+        heap[index] = heap[(index - 1) / 2];
+        index = (index - 1) / 2;
+    }
+    heap[index] = hole;
+}
+
+static void delay_sift_down(struct delayed_item *heap, size_t count, size_t index) {
+    struct delayed_item hole = heap[index];
+    size_t child;
+
+    while ((child = 2 * index + 1) < count) {
+        if (child + 1 < count && heap[child + 1].due < heap[child].due) {
+            child++;
+        }
+        if (heap[child].due >= hole.due) {
+            break;
+        }
+        heap[index] = heap[child];
+        index = child;
+    }
+    heap[index] = hole;
+}
+
+/**
+ * @brief Insert an item that may only be extracted from its due time on
+ * 
+ * @param queue: Pointer to a strict priority queue without payloads
+ * @param item: Item to be inserted
+ * @param due: CLOCK_MONOTONIC time in ns, items already due are pushed at once
+ * 
+ * @returns 0 for success, -EACCES for overflow, -EINVAL for radix queues or
+ *          when the engine cannot take the priority and -ENOMEM for failure
+ */
+static int push_delayed(struct priority_queue *queue, struct item_t item, u64 due) {
+    struct delay_queue *dq = queue->delayed;
+
+    /* The minimum may pass the item's priority before it is due, and
+       releasing it then would make a radix queue go back in priority */
+    if (queue->radix) {
+        debug_printk(
+            KERN_ALERT "<push_delayed@%d>: Radix queues take no delayed items!\n", 
+            current->pid
+        );
+        return -EINVAL;
+    }
+
+    if (due <= ktime_get_ns()) {
+        return push(queue, item, NULL);
+    }
+
+    /* Bucket queues must take it once due, check their range now */
+    if (check_prio(queue, item.priority)) {
+        return -EINVAL;
+    }
+    if (held_items(queue) >= queue->capacity) {
+        debug_printk(KERN_ALERT "<push_delayed@%d>: Overflow in the queue!\n", current->pid);
+        this_cpu_inc(queue->owner->stats->overflows);
+        return -EACCES;
+    }
+
+    if (dq == NULL) {
+        dq = kzalloc(sizeof(*dq), GFP_KERNEL);
+        if (dq == NULL) {
+            return -ENOMEM;
+        }
+        dq->owner = queue->owner;
+        INIT_WORK(&dq->work, release_work);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+        hrtimer_setup(&dq->timer, delay_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#else
+        hrtimer_init(&dq->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+        dq->timer.function = delay_timer;
+#endif
+        queue->delayed = dq;
+    }
+
+    if (dq->count == dq->allocated) {
+        size_t allocated = min(max_t(size_t, dq->allocated * 2, MIN_PQ_ALLOC), queue->capacity);
+        struct delayed_item *heap = kvmalloc_array(allocated, sizeof(*heap), GFP_KERNEL);
+        if (heap == NULL) {
+            debug_printk(
+                KERN_ALERT "<push_delayed@%d>: Cannot allocate [%zu] delayed items!\n", 
+                current->pid, allocated
+            );
+            return -ENOMEM;
+        }
+        if (dq->count > 0) {
+            memcpy(heap, dq->heap, dq->count * sizeof(*heap));
+        }
+        kvfree(dq->heap);
+        dq->heap      = heap;
+        dq->allocated = allocated;
+    }
+
+    dq->heap[dq->count] = (struct delayed_item) { .due = due, .item = item };
+    delay_sift_up(dq->heap, dq->count++);
+
+    if (dq->heap[0].due == due) {
+        /* The new item is the earliest, the timer must fire sooner */
+        hrtimer_start(&dq->timer, ns_to_ktime(due), HRTIMER_MODE_ABS);
+    }
+    return 0;
+}
+
+/**
+ * @brief Move every delayed item that is due into a priority queue, at once,
+ * and arm the timer on the next one. Called with the queue lock held.
+ * 
+ * @param queue: Pointer to priority queue structure
+ * 
+ * @returns Number of items moved
+ */
+static size_t release_due(struct priority_queue *queue) {
+    struct delay_queue *dq = queue->delayed;
+    size_t n = 0;
+
+    if (dq == NULL || dq->count == 0) {
+        return 0;
+    }
+
+    u64 now = ktime_get_ns();
+    while (dq->count > 0 && dq->heap[0].due <= now) {
+        struct delayed_item due = dq->heap[0];
+
+        dq->heap[0] = dq->heap[--dq->count];
+        delay_sift_down(dq->heap, dq->count, 0);
+
+        /* The capacity has room for it, only growing the array may fail */
+        if (reserve_items(queue, n + 1) <= n) {
+            dq->heap[dq->count] = due;
+            delay_sift_up(dq->heap, dq->count++);
+            break;
+        }
+        queue->items[queue->count + n++] = due.item;
+    }
+    push_appended(queue, n);
+
+    /* Items left due for lack of memory wait for the next command instead */
+    if (dq->count > 0 && dq->heap[0].due > now && !dq->dying) {
+        hrtimer_start(&dq->timer, ns_to_ktime(dq->heap[0].due), HRTIMER_MODE_ABS);
+    }
+    return n;
+}
+
+/**
+ * @brief Release the due items of a queue, scheduled by `delay_timer`
+ */
+static void release_work(struct work_struct *work) {
+    struct delay_queue *dq = container_of(work, struct delay_queue, work);
+    struct queue_list *queue_list = dq->owner;
+
+    mutex_lock(&queue_list->lock);
+    if (release_due(queue_list->queue) > 0) {
+        queue_changed(queue_list);
+    }
+    mutex_unlock(&queue_list->lock);
+}
+
+/**
+ * @brief Timer callback at the earliest due time, which cannot take the
+ * queue lock itself
+ */
+static enum hrtimer_restart delay_timer(struct hrtimer *timer) {
+    struct delay_queue *dq = container_of(timer, struct delay_queue, timer);
+
+    queue_work(system_highpri_wq, &dq->work);
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * @brief Stop the timer of a priority queue and drop its delayed items.
+ * Called without the queue lock, which `release_work` takes.
+ * 
+ * @param dq: Pointer to delay_queue structure, may be NULL
+ */
+static void free_delayed(struct delay_queue *dq) {
+    if (dq == NULL) {
+        return;
+    }
+    /* Once `dying` is seen under the queue lock, `release_due` never arms
+       the timer again, so a cancelled timer cannot queue the work anew */
+    mutex_lock(&dq->owner->lock);
+    dq->dying = true;
+    mutex_unlock(&dq->owner->lock);
+
+    hrtimer_cancel(&dq->timer);
+    cancel_work_sync(&dq->work);
+    kvfree(dq->heap);
+    kfree(dq);
+}
+
+
+#define SNAPSHOT_CHUNK 32          /* items of a bucket queue saved per copy */
+
+/**
+ * @brief Write the items of a priority queue to userspace as a snapshot blob
+ * (see PB2_SNAPSHOT_SAVE)
+ * 
+ * Bucket queues are written bucket by bucket, oldest item first, through a
+ * small buffer, so that loading the blob keeps their FIFO order. The other
+ * engines copy their array as it is.
+ * 
+ * @param queue: Pointer to the priority queue
+ * @param snapshot: Buffer given by userspace, whose `size` is set to the size
+ *                  of the blob
+ * 
+ * @returns 0 for success, -EINVAL when the buffer is too small or cannot be
+ *          written
+ */
+static int save_snapshot(struct priority_queue *queue, struct obj_snapshot *snapshot) {
+    struct obj_snapshot_header header = {
+        .magic    = PB2_SNAPSHOT_MAGIC,
+        .version  = PB2_SNAPSHOT_VERSION,
+        .engine   = queue->radix ? PB2_ENGINE_RADIX : 
+                    queue->buckets ? PB2_ENGINE_BUCKET : PB2_ENGINE_HEAP,
+        .arity    = HEAP_ARITY,
+        .range    = queue->buckets ? queue->buckets->range : 0,
+        .capacity = queue->capacity,
+        .count    = queue->count,
+        .reserved = 0,
+    };
+    size_t size = sizeof(header) + queue->count * sizeof(struct item_t);
+    void __user *to = u64_to_user_ptr(snapshot->buf);
+    int32_t given = snapshot->size;
+
+    snapshot->size = size;
+    if (snapshot->buf == 0) {
+        return 0;
+    }
+    if (given < 0 || (size_t) given < size) {
+        debug_printk(
+            KERN_ALERT "<save_snapshot@%d>: Buffer of %d bytes is too small for [%zu]!\n", 
+            current->pid, given, size
+        );
+        return -EINVAL;
+    }
+
+    if (copy_to_user(to, &header, sizeof(header))) {
+        return -EINVAL;
+    }
+    to += sizeof(header);
+
+    if (queue->buckets == NULL) {
+        if (copy_to_user(to, queue->items, queue->count * sizeof(struct item_t))) {
+            return -EINVAL;
+        }
+        return 0;
+    }
+
+    struct bucket_queue *bq = queue->buckets;
+    struct item_t chunk[SNAPSHOT_CHUNK];
+    size_t n = 0, done = 0;
+    u32 b, slot;
+
+    for (b = 0; b < bq->range; b++) {
+        for (slot = bq->head[b]; slot != BUCKET_NONE; slot = bq->next[slot]) {
+            chunk[n++] = queue->items[slot];
+            if (n < SNAPSHOT_CHUNK && done + n < queue->count) {
+                continue;
+            }
+            if (copy_to_user(to + done * sizeof(struct item_t), chunk, 
+                    n * sizeof(struct item_t))) {
+                return -EINVAL;
+            }
+            done += n;
+            n = 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Fill an empty priority queue from a snapshot blob in userspace (see
+ * PB2_SNAPSHOT_LOAD)
+ * 
+ * The items are copied straight into the array and their priorities are
+ * always checked, since relaxed shards and the other engines rely on them. A
+ * min-max heap saved with the same arity then only needs an O(n) check of its
+ * order, skipped when userspace trusts the blob: a heap out of order returns
+ * items out of order, but cannot harm the module. Every other blob goes
+ * through `push_appended`.
+ * 
+ * @param queue: Pointer to the priority queue
+ * @param snapshot: Blob given by userspace
+ * 
+ * @returns 0 for success, -EINVAL for a malformed blob or a priority the
+ *          queue does not take, -EBUSY when the queue holds items, -EACCES
+ *          when the blob holds more items than the capacity and -ENOMEM for
+ *          failure
+ */
+static int load_snapshot(struct priority_queue *queue, struct obj_snapshot *snapshot) {
+    struct obj_snapshot_header header;
+    void __user *from = u64_to_user_ptr(snapshot->buf);
+    size_t index, n;
+    int status;
+
+    if (held_items(queue) > 0) {
+        debug_printk(
+            KERN_ALERT "<load_snapshot@%d>: Queue holds %zu items already!\n", 
+            current->pid, held_items(queue)
+        );
+        return -EBUSY;
+    }
+
+    if (snapshot->size < (int32_t) sizeof(header) || 
+            copy_from_user(&header, from, sizeof(header))) {
+        return -EINVAL;
+    }
+    if (header.magic != PB2_SNAPSHOT_MAGIC || header.version != PB2_SNAPSHOT_VERSION || 
+            header.count < 0 || snapshot->size - sizeof(header) != 
+            (size_t) header.count * sizeof(struct item_t)) {
+        debug_printk(
+            KERN_ALERT "<load_snapshot@%d>: Malformed snapshot of %d bytes!\n", 
+            current->pid, snapshot->size
+        );
+        return -EINVAL;
+    }
+
+    n = header.count;
+    if (n > queue->capacity) {
+        debug_printk(
+            KERN_ALERT "<load_snapshot@%d>: Snapshot of %zu items overflows the capacity [%zu]!\n", 
+            current->pid, n, queue->capacity
         );
         return -EACCES;
     }
+    if (n > queue->allocated) {
+        status = resize_items(queue, n);
+        if (status) {
+            /* Error will be reported in `resize_items` method */
+            return status;
+        }
+    }
+
+    if (copy_from_user(queue->items, from + sizeof(header), n * sizeof(struct item_t))) {
+        return -EINVAL;
+    }
+
+    bool layout = is_heap(queue) && queue->index == NULL && 
+        header.engine == PB2_ENGINE_HEAP && header.arity == HEAP_ARITY;
+    bool trusted = layout && (snapshot->flags & PB2_SNAPSHOT_TRUST);
+
+    /* Trust only skips the heap order check, never the priorities themselves */
+    if (queue->radix) {
+        /* An empty radix queue takes any priority again */
+        queue->radix->last = 0;
+    }
+    for (index = 0; index < n; index++) {
+        if (queue->items[index].priority <= 0 ||
+                check_prio(queue, queue->items[index].priority)) {
+            debug_printk(
+                KERN_ALERT "<load_snapshot@%d>: Invalid priority of item %zu!\n",
+                current->pid, index
+            );
+            return -EINVAL;
+        }
+    }
+
+    if (!trusted && !(layout && heap_valid(queue->items, n))) {
+        /* Rebuilt in the order of the queue's engine */
+        push_appended(queue, n);
+        return 0;
+    }
+
+    queue->count = n;
+    this_cpu_add(queue->owner->stats->inserts, n);
+    note_count(queue->owner, n);
+
+    if (trace_pqkmod_insert_enabled()) {
+        for (index = 0; index < n; index++) {
+            trace_pqkmod_insert(queue->owner->id, queue->items[index].value, 
+                queue->items[index].priority, index + 1);
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Allocate and add priority queue for given process in the linked list 
+ * 
+ * @param pid: pid of the process
+ * 
+ * @return `queue_list` instance holding one reference (NULL in case of failure)
+ */
+static struct queue_list *add_queue_list(pid_t pid) {
+    struct queue_list *queue_list = (struct queue_list *) 
+        kmem_cache_alloc(queue_list_cache, GFP_KERNEL);
+    if (queue_list == NULL) {
+        debug_printk(KERN_ALERT "<add_queue@%d>: Failed to allocate the queue!\n", pid);
+        return NULL;
+    }
+
+    *queue_list = (struct queue_list) {
+        .pid                  = pid,
+        .id                   = atomic_inc_return(&next_queue_id),
+        .queue                = NULL,
+        .relaxed              = NULL,
+        .name                 = "",
+        .retain               = 0,
+        .retained             = false,
+        .stats                = alloc_percpu(struct queue_stats),
+        .high_water           = 0,
+        .stat_count           = 0,
+        .stat_capacity        = 0,
+        .events               = 0,
+    };
+    if (queue_list->stats == NULL) {
+        kmem_cache_free(queue_list_cache, queue_list);
+        return NULL;
+    }
+    kref_init(&queue_list->ref);
+    INIT_DELAYED_WORK(&queue_list->grace, retain_expired);
+    mutex_init(&queue_list->lock);
+    init_waitqueue_head(&queue_list->wait);
+
+    char file_name[16];
+    snprintf(file_name, sizeof(file_name), "%u", queue_list->id);
+    queue_list->stats_file = debugfs_create_file(file_name, 0444, debugfs_dir, 
+        queue_list, &queue_info_fops);
+
+    mutex_lock(&qlock);
+    list_add_rcu(&queue_list->list, &queues);
+    mutex_unlock(&qlock);
+
+    debug_printk(KERN_INFO "<add_queue@%d>: Successfully added the queue.\n", pid);
+    return queue_list;
+}
+
+
+/**
+ * @brief Drop a file's reference to a priority queue, deleting the queue when
+ * it was the last one
+ * 
+ * @param queue_list: `queue_list` instance
+ */
+static void put_queue_list(struct queue_list *queue_list) {
+    /* `qlock` is taken only for the last reference, see `delete_queue_list` */
+    kref_put_mutex(&queue_list->ref, delete_queue_list, &qlock);
+}
+
+
+/**
+ * @brief Unlink and deallocate a priority queue. Called by `kref_put_mutex`
+ * with `qlock` held, so that `find_queue_list` cannot hand out the queue
+ * meanwhile; releases `qlock`.
+ * 
+ * A queue to be retained (see PB2_SET_RETAIN) is kept instead, with a
+ * reference of its own that `retain_expired` drops at the end of the grace
+ * period, unless a file adopts it first.
+ * 
+ * @param ref: `ref` of the `queue_list` instance to be deleted
+ */
+static void delete_queue_list(struct kref *ref) {
+    struct queue_list *queue_list = container_of(ref, struct queue_list, ref);
+    u32 retain = READ_ONCE(queue_list->retain);
+
+    if (retain > 0 && !queue_list->retained) {
+        kref_init(&queue_list->ref);
+        queue_list->retained = true;
+        queue_delayed_work(pqkmod_wq, &queue_list->grace, retain * HZ);
+        mutex_unlock(&qlock);
+
+        debug_printk(KERN_INFO "<delete_queue@%d>: Retained the queue for %u s.\n", 
+            queue_list->pid, retain);
+        return;
+    }
+
+    list_del_rcu(&queue_list->list);
+    if (queue_list->name[0] != '\0') {
+        hash_del(&queue_list->node);
+    }
+    mutex_unlock(&qlock);
+
+    debug_printk(KERN_INFO "<delete_queue@%d>: Successfully deleted the queue.\n", 
+        queue_list->pid);
+    free_queue_list(queue_list);
+}
+
+
+/**
+ * @brief Internal helper subroutine for `delete_queue_list`.
+ */
+static void free_queue_list(struct queue_list *queue_list) {
+    /* No mutex lock and unlock as this is an internal helper subroutine */
+    if (queue_list == NULL) {
+        debug_printk(KERN_ALERT "<free_queue_list@%d>: Attempt to deallocate null pointer!\n", current->pid);
+        return;
+    }
+    /* Waits for readers of the statistics file of the queue */
+    debugfs_remove(queue_list->stats_file);
+
+    free_queue(queue_list->queue);
+    free_relaxed(queue_list->relaxed);
+    free_notify(queue_list->notify);
+    mutex_destroy(&queue_list->lock);
+    debug_printk(KERN_INFO "<free_queue_list@%d>: Deallocated the queue.\n", queue_list->pid);
+
+    /* RCU readers of `queues` may still be looking at the instance */
+    call_rcu(&queue_list->rcu, free_queue_list_rcu);
+}
+
+
+/**
+ * @brief Look up a named priority queue. Called with `qlock` held.
+ * 
+ * @param name: Name of the queue
+ * 
+ * @return `queue_list` instance (NULL if there is no queue of that name)
+ */
+static struct queue_list *find_queue_list(const char *name) {
+    struct queue_list *queue_list;
+    u32 key = full_name_hash(NULL, name, strlen(name));
+
+    hash_for_each_possible(named_queues, queue_list, node, key) {
+        if (strcmp(queue_list->name, name) == 0) {
+            return queue_list;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Attach a file to the priority queue of given name
+ * 
+ * If a queue of that name exists, the file joins it, and its own queue is
+ * kept aside (it is only freed on release, as other threads may still be
+ * using it). Otherwise the file's own queue takes the name, keeping its
+ * items, so that other processes can join it.
+ * 
+ * The per-file state (rings and the cached item value) is only used under
+ * the lock of the attached queue, see `lock_file_queue`. Switching queues
+ * would leave it under two locks, so it must not exist yet, and the switch
+ * happens under the lock of the file's own queue.
+ * 
+ * @param queue_file: File to be attached
+ * @param name: Name of the queue, non-empty and NUL-terminated
+ * 
+ * @return 0 (if successful)
+ *         -EBUSY
+ *             - when the file is already attached to a named queue
+ *             - when the file set up rings or cached an item value
+ */
+static int attach_queue_list(struct queue_file *queue_file, const char *name) {
+    struct queue_list *own = queue_file->queue_list;
+
+    /* Relaxed queues use no per-file state and take no lock */
+    struct relaxed_queue *relaxed = lock_queue_list(own);
+    mutex_lock(&qlock);
+
+    if (queue_file->detached != NULL || own->name[0] != '\0' || 
+            queue_file->ring != NULL || queue_file->is_item_value_cached) {
+        mutex_unlock(&qlock);
+        if (relaxed == NULL) {
+            mutex_unlock(&own->lock);
+        }
+        return -EBUSY;
+    }
+
+    struct queue_list *queue_list = find_queue_list(name);
+    if (queue_list != NULL) {
+        /* A retained queue is adopted with the reference of its grace period,
+           unless the period is over and `retain_expired` waits for `qlock` */
+        if (!(queue_list->retained && cancel_delayed_work(&queue_list->grace))) {
+            kref_get(&queue_list->ref);
+        }
+        queue_list->retained = false;
+        queue_file->detached = own;
+        WRITE_ONCE(queue_file->queue_list, queue_list);
+    } else {
+        strscpy(own->name, name, sizeof(own->name));
+        hash_add(named_queues, &own->node, full_name_hash(NULL, name, strlen(name)));
+    }
+
+    mutex_unlock(&qlock);
+    if (relaxed == NULL) {
+        mutex_unlock(&own->lock);
+    }
+
+    debug_printk(KERN_INFO "<attach_queue@%d>: Attached to queue \"%s\".\n", 
+        current->pid, name);
+    return 0;
+}
+
+
+/**
+ * @brief Make a named priority queue outlive its last file for a while, so
+ * that a restarted process can adopt it
+ * 
+ * @param queue_list: `queue_list` instance
+ * @param seconds: Grace period after the last release, 0 to delete the queue
+ *                 right away
+ * 
+ * @return 0 (if successful)
+ *         -EINVAL
+ *             - when the queue is anonymous or `seconds` is out of
+ *               [0, PB2_MAX_RETAIN]
+ */
+static int set_retain(struct queue_list *queue_list, int32_t seconds) {
+    if (seconds < 0 || seconds > PB2_MAX_RETAIN) {
+        debug_printk(
+            KERN_ALERT "<set_retain@%d>: Grace period should be in range [0, %d], got %d!\n", 
+            current->pid, PB2_MAX_RETAIN, seconds
+        );
+        return -EINVAL;
+    }
+    /* Names are set once, under `qlock` which cannot be taken here */
+    if (READ_ONCE(queue_list->name[0]) == '\0') {
+        debug_printk(
+            KERN_ALERT "<set_retain@%d>: Only named queues can be adopted!\n", current->pid
+        );
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(queue_list->retain, seconds);
+    return 0;
+}
+
+
+/**
+ * @brief End the grace period of a retained priority queue, deleting it
+ * unless a file attached to it meanwhile
+ */
+static void retain_expired(struct work_struct *work) {
+    struct queue_list *queue_list = container_of(to_delayed_work(work), 
+        struct queue_list, grace);
+
+    mutex_lock(&qlock);
+    /* `delete_queue_list` releases `qlock` itself */
+    if (!kref_put(&queue_list->ref, delete_queue_list)) {
+        queue_list->retained = false;
+        mutex_unlock(&qlock);
+    }
+}
+
+
+/**
+ * @brief RCU callback of `free_queue_list`, frees the instance itself and
+ * its statistics
+ */
+static void free_queue_list_rcu(struct rcu_head *rcu) {
+    struct queue_list *queue_list = container_of(rcu, struct queue_list, rcu);
+
+    /* Read by `queue_table_show` under RCU */
+    free_percpu(queue_list->stats);
+    kmem_cache_free(queue_list_cache, queue_list);
+}
+
+
+/**
+ * @brief Deallocates entire linked list of priority queues. It is an 
+ * internal helper subroutine used by `module_exit`.
+ */
+static void free_list(void) {
+    struct queue_list *p;
+
+    /* End pending grace periods now, their work deletes retained queues; a
+       work that is running already must not be queued again */
+    mutex_lock(&qlock);
+    list_for_each_entry(p, &queues, list) {
+        if (p->retained && cancel_delayed_work(&p->grace)) {
+            queue_delayed_work(pqkmod_wq, &p->grace, 0);
+        }
+    }
+    mutex_unlock(&qlock);
+    drain_workqueue(pqkmod_wq);
+
+    /* Queues are freed without `qlock`, which nests inside queue locks */
+    mutex_lock(&qlock);
+    while (!list_empty(&queues)) {
+        p = list_first_entry(&queues, struct queue_list, list);
+        list_del_rcu(&p->list);
+        if (p->name[0] != '\0') {
+            hash_del(&p->node);
+        }
+        mutex_unlock(&qlock);
+        free_queue_list(p);
+        mutex_lock(&qlock);
+    }
+    mutex_unlock(&qlock);
+
+    /* Wait for pending `free_queue_list_rcu` callbacks before unloading */
+    rcu_barrier();
+    debug_printk(KERN_INFO "<free_list>: Deallocated all the queues.\n");
+}
+
+
+/**
+ * @brief Prints pid of processes for which priority queue is stil alive, when
+ * debugging is enabled.
+ */
+static void print_list(void) {
+    if (!static_branch_unlikely(&debug_key)) {
+        return;
+    }
+
+    rcu_read_lock();
+
+    struct queue_list *q;
+    printk(KERN_INFO "<print_queue_list>: [");
+    list_for_each_entry_rcu(q, &queues, list) {
+        printk("%d%s%s, ", q->pid, q->name[0] ? ":" : "", q->name);
+    }
+    printk("]\n");
+
+    rcu_read_unlock();
+}
+
+
+
+/**
+ * @brief Record the number of items of a queue for its high-water mark. Racy
+ * updates of relaxed queues may lose a maximum, which is fine for statistics.
+ */
+static void note_count(struct queue_list *queue_list, size_t count) {
+    if (count > READ_ONCE(queue_list->high_water)) {
+        WRITE_ONCE(queue_list->high_water, count);
+    }
+}
+
+
+/**
+ * @brief Record the latency of an insert or extract operation
+ * 
+ * @param queue_list: `queue_list` instance operated on
+ * @param extract: 1 for the extract histogram, 0 for the insert one
+ * @param start: `ktime_get_ns()` when the operation entered the module
+ */
+static void note_latency(struct queue_list *queue_list, int extract, u64 start) {
+    u64 ns = ktime_get_ns() - start;
+    unsigned int bucket = min_t(unsigned int, ilog2(ns | 1), STAT_BUCKETS - 1);
+
+    if (extract) {
+        this_cpu_inc(queue_list->stats->extract_lat[bucket]);
+    } else {
+        this_cpu_inc(queue_list->stats->insert_lat[bucket]);
+    }
+}
+
+
+/**
+ * @brief Sum the per-CPU statistics of a queue
+ */
+static void collect_stats(struct queue_list *queue_list, struct queue_stats *sum) {
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        struct queue_stats *stats = per_cpu_ptr(queue_list->stats, cpu);
+
+        sum->inserts    += stats->inserts;
+        sum->extracts   += stats->extracts;
+        sum->overflows  += stats->overflows;
+        sum->underflows += stats->underflows;
+        for (i = 0; i < STAT_BUCKETS; i++) {
+            sum->insert_lat [i] += stats->insert_lat [i];
+            sum->extract_lat[i] += stats->extract_lat[i];
+        }
+    }
+}
+
+
+/**
+ * @brief Get the number of items and the capacity of a queue, 0 for both
+ * when it is not initialized
+ * 
+ * They are copies taken after every change, so that a queue whose owner
+ * stalls with its lock held never blocks the statistics; racing relaxed
+ * operations may leave a slightly stale count.
+ */
+static void queue_size(struct queue_list *queue_list, size_t *count, size_t *capacity) {
+    *count    = READ_ONCE(queue_list->stat_count);
+    *capacity = READ_ONCE(queue_list->stat_capacity);
+}
+
+
+/**
+ * @brief Print the non-empty buckets of a latency histogram
+ */
+static void show_histogram(struct seq_file *m, const char *title, u64 *buckets) {
+    int i;
+
+    seq_printf(m, "%s latency (ns):\n", title);
+    for (i = 0; i < STAT_BUCKETS; i++) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        if (i == STAT_BUCKETS - 1) {
+            seq_printf(m, "  [%12llu, %12s): %llu\n", 1ULL << i, "inf", buckets[i]);
+        } else {
+            seq_printf(m, "  [%12llu, %12llu): %llu\n", 1ULL << i, 1ULL << (i + 1), 
+                buckets[i]);
+        }
+    }
+}
+
+
+/**
+ * @brief Show the statistics of one queue, in <debugfs>/pqkmod/<id>
+ */
+static int queue_info_show(struct seq_file *m, void *v) {
+    struct queue_list *queue_list = m->private;
+    struct queue_stats sum;
+    size_t count, capacity;
+
+    collect_stats(queue_list, &sum);
+    queue_size(queue_list, &count, &capacity);
+
+    seq_printf(m, "id:         %u\n", queue_list->id);
+    seq_printf(m, "name:       %s\n", queue_list->name);
+    seq_printf(m, "pid:        %d\n", queue_list->pid);
+    seq_printf(m, "mode:       %s\n", READ_ONCE(queue_list->relaxed) ? "relaxed" : "strict");
+    seq_printf(m, "count:      %zu\n", count);
+    seq_printf(m, "capacity:   %zu\n", capacity);
+    seq_printf(m, "high_water: %zu\n", READ_ONCE(queue_list->high_water));
+    seq_printf(m, "inserts:    %llu\n", sum.inserts);
+    seq_printf(m, "extracts:   %llu\n", sum.extracts);
+    seq_printf(m, "overflows:  %llu\n", sum.overflows);
+    seq_printf(m, "underflows: %llu\n", sum.underflows);
+    show_histogram(m, "insert", sum.insert_lat);
+    show_histogram(m, "extract", sum.extract_lat);
+    return 0;
+}
+
+
+/**
+ * @brief Show one line of statistics per queue, in <debugfs>/pqkmod/queues
+ */
+static int queue_table_show(struct seq_file *m, void *v) {
+    struct queue_list *queue_list;
+    struct queue_stats sum;
+    size_t count, capacity;
+
+    seq_printf(m, "%8s %8s %-16s %10s %10s %10s %12s %12s %10s %10s\n", "id", "pid", 
+        "name", "count", "capacity", "high_water", "inserts", "extracts", 
+        "overflows", "underflows");
+
+    /* No lock is taken, so a stalled queue or `qlock` holder cannot block
+       the table; the statistics of a queue are freed after a grace period */
+    rcu_read_lock();
+    list_for_each_entry_rcu(queue_list, &queues, list) {
+        collect_stats(queue_list, &sum);
+        queue_size(queue_list, &count, &capacity);
+
+        seq_printf(m, "%8u %8d %-16s %10zu %10zu %10zu %12llu %12llu %10llu %10llu\n", 
+            queue_list->id, queue_list->pid, 
+            queue_list->name[0] ? queue_list->name : "-", count, capacity, 
+            READ_ONCE(queue_list->high_water), sum.inserts, sum.extracts, 
+            sum.overflows, sum.underflows);
+    }
+    rcu_read_unlock();
+    return 0;
+}
+
+
+/**
+ * @brief Lock a priority queue unless it is relaxed
+ * 
+ * Relaxed queues never go back to the strict mode, so once `relaxed` is seen
+ * set, the instance lock is not needed anymore.
+ * 
+ * @param queue_list: `queue_list` instance
+ * 
+ * @return `relaxed_queue` instance, with the lock of `queue_list` not held
+ *         (if relaxed) or NULL, with the lock of `queue_list` held
+ */
+static struct relaxed_queue *lock_queue_list(struct queue_list *queue_list) {
+    struct relaxed_queue *relaxed = smp_load_acquire(&queue_list->relaxed);
+    if (relaxed != NULL) {
+        return relaxed;
+    }
+
+    mutex_lock(&queue_list->lock);
+    /* PB2_SET_RELAXED may have completed while waiting for the lock */
+    relaxed = queue_list->relaxed;
+    if (relaxed != NULL) {
+        mutex_unlock(&queue_list->lock);
+    }
+    return relaxed;
+}
+
+
+/**
+ * @brief Lock the priority queue a file is attached to, unless it is relaxed
+ * 
+ * PB2_ATTACH may switch the file to another queue while waiting for the
+ * lock, in which case the new queue is locked instead, so that the per-file
+ * state is always used under the lock of the file's current queue.
+ * 
+ * @param queue_file: File whose queue is to be locked
+ * @param relaxed: Set like `lock_queue_list` returns it
+ * 
+ * @return `queue_list` instance the file is attached to
+ */
+static struct queue_list *lock_file_queue(struct queue_file *queue_file, 
+                                          struct relaxed_queue **relaxed) {
+    for (;;) {
+        struct queue_list *queue_list = READ_ONCE(queue_file->queue_list);
+
+        *relaxed = lock_queue_list(queue_list);
+        if (*relaxed != NULL || READ_ONCE(queue_file->queue_list) == queue_list) {
+            return queue_list;
+        }
+        mutex_unlock(&queue_list->lock);
+    }
+}
+
+
+/**
+ * @brief Split a priority queue into shards. Called with the lock of
+ * `queue_list` held.
+ * 
+ * @param queue_list: `queue_list` instance with an initialized queue
+ * @param obj_relaxed: Number of shards (0 for one per online CPU) and number
+ * of shards sampled per extract
+ * 
+ * @return 0 (if successful)
+ *         -EINVAL
+ *             - out of range shards or choices
+ *         -ENOMEM
+ *             - shard allocation failed
+ */
+static int set_relaxed(struct queue_list *queue_list, struct obj_relaxed *obj_relaxed) {
+    struct priority_queue *queue = queue_list->queue;
+    u32 shards = obj_relaxed->shards ? obj_relaxed->shards : num_online_cpus();
+    size_t i;
+
+    if (obj_relaxed->shards < 0 || obj_relaxed->choices <= 0) {
+        return -EINVAL;
+    }
+    if (queue->index || queue->arena || queue->delayed || !is_heap(queue)) {
+        /* Handles, payloads and timers cannot follow items across shards, which are heaps */
+        return -EBUSY;
+    }
+    /* Every shard holds at least one item of the capacity */
+    shards = min_t(size_t, min_t(u32, shards, MAX_RELAXED_SHARDS), queue->capacity);
+
+    struct relaxed_queue *relaxed = (struct relaxed_queue *) 
+        kzalloc(struct_size(relaxed, shard, shards), GFP_KERNEL);
+    if (relaxed == NULL) {
+        return -ENOMEM;
+    }
+
+    relaxed->shards   = shards;
+    relaxed->choices  = obj_relaxed->choices;
+    relaxed->capacity = queue->capacity;
+    for (i = 0; i < shards; i++) {
+        /* The capacities add up to that of `queue`, so it still bounds the items */
+        size_t capacity = queue->capacity / shards + (i < queue->capacity % shards);
+        /* Room for the share of the items dealt to the shard below */
+        size_t share = queue->count / shards + (i < queue->count % shards);
+
+        mutex_init(&relaxed->shard[i].lock);
+        relaxed->shard[i].queue = create_queue(capacity, queue_list);
+        if (relaxed->shard[i].queue == NULL || 
+                (share > relaxed->shard[i].queue->allocated && 
+                 resize_items(relaxed->shard[i].queue, share))) {
+            relaxed->shards = i + 1;
+            free_relaxed(relaxed);
+            return -ENOMEM;
+        }
+    }
+
+    /* Deal the items out round-robin, which cannot fail: a share never exceeds its capacity */
+    for (i = 0; i < queue->count; i++) {
+        push(relaxed->shard[i % shards].queue, queue->items[i], NULL);
+    }
+    /* Moving items is not inserting them */
+    this_cpu_sub(queue_list->stats->inserts, queue->count);
+    for (i = 0; i < shards; i++) {
+        shard_changed(&relaxed->shard[i]);
+    }
+    atomic_set(&relaxed->count, queue->count);
+    WRITE_ONCE(queue_list->stat_capacity, relaxed->capacity);
+
+    free_queue(queue);
+    queue_list->queue = NULL;
+    smp_store_release(&queue_list->relaxed, relaxed);
+
+    debug_printk(
+        KERN_INFO DEVICE_NAME " <set_relaxed@%d>: Queue split into %u shards, "
+        "sampling %u per extract.\n", current->pid, shards, relaxed->choices
+    );
+    return 0;
+}
+
+
+/**
+ * @brief Deallocate the shards of a relaxed priority queue
+ */
+static void free_relaxed(struct relaxed_queue *relaxed) {
+    u32 i;
+
+    if (relaxed == NULL) {
+        return;
+    }
+    for (i = 0; i < relaxed->shards; i++) {
+        free_queue(relaxed->shard[i].queue);
+        mutex_destroy(&relaxed->shard[i].lock);
+    }
+    kfree(relaxed);
+}
+
+
+/**
+ * @brief Refresh the cached top priorities of a shard. Called with the shard
+ * lock held.
+ */
+static void shard_changed(struct pq_shard *shard) {
+    struct priority_queue *queue = shard->queue;
+
+    WRITE_ONCE(shard->min_prio, queue->count ? peek_min(queue)->priority : 0);
+    WRITE_ONCE(shard->max_prio, queue->count ? peek_max(queue)->priority : 0);
+}
+
+
+/**
+ * @brief Pick the shard with the best top item among a few
+ * 
+ * @param relaxed: `relaxed_queue` instance
+ * @param max: 1 to look for the maximum priority, 0 for the minimum
+ * @param samples: Number of random shards to compare, 0 for all of them
+ * 
+ * @return `pq_shard` instance (NULL when every sampled shard looked empty)
+ */
+static struct pq_shard *best_shard(struct relaxed_queue *relaxed, int max, u32 samples) {
+    struct pq_shard *best = NULL;
+    int32_t best_prio = 0;
+    u32 i, n = samples ? samples : relaxed->shards;
+
+    for (i = 0; i < n; i++) {
+        u32 index = i;
+        if (samples) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+            index = get_random_u32_below(relaxed->shards);
+#else
+            index = prandom_u32_max(relaxed->shards);
+#endif
+        }
+
+        struct pq_shard *shard = &relaxed->shard[index];
+        int32_t prio = max ? READ_ONCE(shard->max_prio) : READ_ONCE(shard->min_prio);
+        if (prio == 0) {
+            continue;
+        }
+        if (best == NULL || (max ? prio > best_prio : prio < best_prio)) {
+            best      = shard;
+            best_prio = prio;
+        }
+    }
+    return best;
+}
+
+
+/**
+ * @brief Insert items in a relaxed priority queue, starting with the shard of
+ * the current CPU and wake up waiting readers
+ * 
+ * @param queue_list: `queue_list` instance the queue belongs to
+ * @param relaxed: `relaxed_queue` instance
+ * @param items: Items to be inserted
+ * @param n: Number of items
+ * 
+ * @return Number of items inserted, the rest overflowed
+ */
+static size_t relaxed_push(struct queue_list *queue_list, struct relaxed_queue *relaxed, 
+                           struct item_t *items, size_t n) {
+    u32 first = raw_smp_processor_id() % relaxed->shards;
+    size_t done = 0;
+    u32 i;
+
+    for (i = 0; i < relaxed->shards && done < n; i++) {
+        struct pq_shard *shard = &relaxed->shard[(first + i) % relaxed->shards];
+
+        mutex_lock(&shard->lock);
+        struct priority_queue *queue = shard->queue;
+        size_t k = reserve_items(queue, n - done);
+        if (k > 0) {
+            memcpy(&queue->items[queue->count], &items[done], k * sizeof(struct item_t));
+            push_appended(queue, k);
+            shard_changed(shard);
+        }
+        mutex_unlock(&shard->lock);
+
+        done += k;
+    }
+
+    if (done < n) {
+        this_cpu_add(queue_list->stats->overflows, n - done);
+    }
+    if (done > 0) {
+        size_t count = atomic_add_return(done, &relaxed->count);
+        note_count(queue_list, count);
+        WRITE_ONCE(queue_list->stat_count, count);
+        notify_count(queue_list, count - done, count);
+        if (wq_has_sleeper(&queue_list->wait)) {
+            wake_up_interruptible(&queue_list->wait);
+        }
+    }
+    return done;
+}
+
+
+/**
+ * @brief Extract items from a relaxed priority queue, each one from the best
+ * of `choices` random shards
+ * 
+ * @param queue_list: `queue_list` instance the queue belongs to
+ * @param relaxed: `relaxed_queue` instance
+ * @param items: Buffer for the extracted items
+ * @param n: Maximum number of items to extract
+ * @param max: 1 to extract maximum priority items, 0 for minimum ones
+ * 
+ * @return Number of items extracted (0 when the queue is empty)
+ */
+static size_t relaxed_pop(struct queue_list *queue_list, struct relaxed_queue *relaxed, 
+                          struct item_t *items, size_t n, int max) {
+    u32 samples = relaxed->choices < relaxed->shards ? relaxed->choices : 0;
+    size_t done = 0;
+
+    while (done < n) {
+        struct pq_shard *shard = best_shard(relaxed, max, samples);
+        if (shard == NULL && samples) {
+            /* The samples missed, make sure every shard is empty */
+            shard = best_shard(relaxed, max, 0);
+        }
+        if (shard == NULL) {
+            break;
+        }
+
+        mutex_lock(&shard->lock);
+        struct priority_queue *queue = shard->queue;
+        if (queue->count > 0) {
+            /* The top may have changed since it was sampled, take it anyway */
+            items[done++] = max ? *peek_max(queue) : *peek_min(queue);
+            if (max) {
+                extract_max(queue);
+            } else {
+                extract_min(queue);
+            }
+            shard_changed(shard);
+        }
+        mutex_unlock(&shard->lock);
+    }
+
+    if (done > 0) {
+        size_t count = atomic_sub_return(done, &relaxed->count);
+        notify_count(queue_list, count + done, count);
+        WRITE_ONCE(queue_list->stat_count, count);
+        /* Pollers waiting for room are only woken here */
+        if (wq_has_sleeper(&queue_list->wait)) {
+            wake_up_interruptible(&queue_list->wait);
+        }
+    }
+    return done;
+}
+
+
+/**
+ * @brief Wait until a relaxed priority queue looks non-empty
+ * 
+ * @return 0 (if an item may be available)
+ *         -EAGAIN
+ *             - when the file is non-blocking
+ *         -ERESTARTSYS
+ *             - when interrupted by a signal
+ */
+static int relaxed_wait(struct file *file, struct queue_list *queue_list, 
+                        struct relaxed_queue *relaxed) {
+    if (file->f_flags & O_NONBLOCK) {
+        this_cpu_inc(queue_list->stats->underflows);
+        return -EAGAIN;
+    }
+    if (wait_event_interruptible(queue_list->wait, atomic_read(&relaxed->count) > 0)) {
+        return -ERESTARTSYS;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief `qwrite` for relaxed queues, only whole `struct obj_item` records
+ * are accepted
+ */
+static ssize_t write_relaxed(struct queue_list *queue_list, struct relaxed_queue *relaxed, 
+                             const char *buf, size_t count) {
+    struct item_t items[RELAXED_CHUNK];
+    size_t total = count / sizeof(struct item_t), done = 0;
+
+    if (count % sizeof(struct item_t) != 0) {
+        debug_printk(
+            KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, relaxed queues "
+            "expect whole (value, priority) records!\n", current->pid
+        );
+        return -EINVAL;
+    }
+
+    while (done < total) {
+        size_t n = min_t(size_t, total - done, RELAXED_CHUNK), i;
+
+        if (copy_from_user(items, buf + done * sizeof(struct item_t), 
+                n * sizeof(struct item_t))) {
+            return done ? done * sizeof(struct item_t) : -EINVAL;
+        }
+        for (i = 0; i < n; i++) {
+            if (items[i].priority <= 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, "
+                    "priority must be a positive integer!\n", current->pid
+                );
+                return done ? done * sizeof(struct item_t) : -EINVAL;
+            }
+        }
+
+        size_t pushed = relaxed_push(queue_list, relaxed, items, n);
+        done += pushed;
+        if (pushed < n) {
+            break;
+        }
+    }
+
+    if (done == 0) {
+        debug_printk(KERN_ALERT DEVICE_NAME " <write@%d>: Overflow in the queue!\n", 
+            current->pid);
+        return -EACCES;
+    }
+    return done * sizeof(struct item_t);
+}
+
+
+/**
+ * @brief `read_items` for relaxed queues, extracting approximately minimum
+ * priority items
+ */
+static ssize_t read_relaxed(struct file *file, struct queue_list *queue_list, 
+                            struct relaxed_queue *relaxed, struct iov_iter *to) {
+    struct item_t items[RELAXED_CHUNK];
+    size_t count = iov_iter_count(to);
+    size_t total = count == 4 ? 1 : count / sizeof(struct item_t), done = 0;
+
+    while (done < total) {
+        size_t n = relaxed_pop(queue_list, relaxed, items, 
+            min_t(size_t, total - done, RELAXED_CHUNK), 0);
+        if (n == 0) {
+            if (done > 0) {
+                break;
+            }
+            /* Sleep until an item is pushed (or fail with -EAGAIN if non-blocking) */
+            int status = relaxed_wait(file, queue_list, relaxed);
+            if (status) {
+                return status;
+            }
+            continue;
+        }
+
+        if (count == 4) {
+            if (copy_to_iter(&items[0].value, sizeof(int32_t), to) != sizeof(int32_t)) {
+                relaxed_push(queue_list, relaxed, items, 1);
+                return -EACCES;
+            }
+            return sizeof(int32_t);
+        }
+
+        size_t copied = copy_to_iter(items, n * sizeof(struct item_t), to) 
+            / sizeof(struct item_t);
+        done += copied;
+        if (copied < n) {
+            /* Items that did not reach userspace go back to the queue */
+            relaxed_push(queue_list, relaxed, &items[copied], n - copied);
+            if (done == 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <read@%d>: copy_to_user failed!\n", 
+                    current->pid
+                );
+                return -EACCES;
+            }
+            break;
+        }
+    }
+
+    return done * sizeof(struct item_t);
+}
+
+
+/**
+ * @brief Copy a chunk of a PB2_INSERT_BATCH array from userspace and check its
+ * priorities
+ * 
+ * @param items: Buffer of at least `n` items
+ * @param batch: Batch given by userspace
+ * @param first: Index of the first item of the chunk in the batch
+ * @param n: Number of items in the chunk
+ * 
+ * @return 0 (if successful) and -EINVAL for a fault or a priority that is not
+ *         a positive integer
+ */
+static int copy_batch_chunk(struct item_t *items, struct obj_batch *batch, 
+                            size_t first, size_t n) {
+    size_t i;
+
+    if (copy_from_user(items, u64_to_user_ptr(batch->items) + first * sizeof(struct item_t), 
+            n * sizeof(struct item_t))) {
+        return -EINVAL;
+    }
+    for (i = 0; i < n; i++) {
+        if (items[i].priority <= 0) {
+            debug_printk(
+                KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_BATCH@%d>: "
+                "Invalid argument, priority of item %zu must be a "
+                "positive integer!\n", current->pid, first + i
+            );
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief `qioctl` for relaxed queues, called without the lock of `queue_list`
+ */
+static long ioctl_relaxed(struct file *file, struct queue_list *queue_list, 
+                          struct relaxed_queue *relaxed, unsigned int cmd, 
+                          unsigned long arg) {
+    struct item_t items[RELAXED_CHUNK];
+    struct obj_batch batch;
+    int32_t item_value;
+    size_t n, done;
+    int status;
+
+    switch (cmd) {
+
+        /* The shards cannot be reallocated under concurrent users */
+        case PB2_SET_CAPACITY:
+        case PB2_SET_RELAXED:
+        case PB2_SET_INDEXED:
+        case PB2_CREATE:
+        case PB2_SET_PAYLOAD:
+        case PB2_SET_NOTIFY:
+
+            debug_printk(
+                KERN_ALERT DEVICE_NAME " <qioctl@%d>: Queue is relaxed, it "
+                "cannot be reinitialized!\n", current->pid
+            );
+            return -EBUSY;
+
+        /* Get queue information, the capacity is split over the shards */
+        case PB2_GET_INFO: ;
+
+            struct obj_info obj_info;
+            obj_info.prio_que_size = atomic_read(&relaxed->count);
+            obj_info.capacity      = min_t(size_t, INT_MAX, relaxed->capacity);
+
+            status = copy_to_user(
+                (struct obj_info *) arg, &obj_info, sizeof(struct obj_info)
+            );
+            if (status) {
+                return -EINVAL;
+            }
+            break;
+
+        /* Get (approximately) minimum or maximum priority item */
+        case PB2_GET_MIN:
+        case PB2_GET_MAX:
+
+            while (relaxed_pop(queue_list, relaxed, items, 1, cmd == PB2_GET_MAX) == 0) {
+                status = relaxed_wait(file, queue_list, relaxed);
+                if (status) {
+                    return status;
+                }
+            }
+
+            item_value = items[0].value;
+            status = copy_to_user((int32_t *) arg, &item_value, sizeof(int32_t));
+            if (status) {
+                relaxed_push(queue_list, relaxed, items, 1);
+                return -EINVAL;
+            }
+            break;
+
+        /* Push an array of (value, priority) pairs in one call */
+        case PB2_INSERT_BATCH:
+
+            status = copy_from_user(&batch, (struct obj_batch *) arg, sizeof(batch));
+            if (status) {
+                return -EINVAL;
+            }
+            if (batch.count < 0) {
+                return -EINVAL;
+            }
+
+            /**
+             * As in strict mode, a bad priority among the items that fit
+             * rejects the whole batch, so they are all checked before the
+             * first one is inserted. Chunks are copied again to be inserted
+             * and checked again, as userspace may change them in between.
+             */
+            size_t room = relaxed->capacity - 
+                min_t(size_t, atomic_read(&relaxed->count), relaxed->capacity);
+            size_t fit = min_t(size_t, batch.count, room);
+            this_cpu_add(queue_list->stats->overflows, batch.count - fit);
+
+            for (done = 0; done < fit; done += n) {
+                n = min_t(size_t, fit - done, RELAXED_CHUNK);
+                status = copy_batch_chunk(items, &batch, done, n);
+                if (status) {
+                    return status;
+                }
+            }
+
+            for (done = 0; done < fit; done += n) {
+                n = min_t(size_t, fit - done, RELAXED_CHUNK);
+                status = copy_batch_chunk(items, &batch, done, n);
+                if (status) {
+                    break;
+                }
+
+                size_t pushed = relaxed_push(queue_list, relaxed, items, n);
+                if (pushed < n) {
+                    done += pushed;
+                    break;
+                }
+            }
+
+            /* Report how many items made it, the rest overflowed */
+            batch.done = done;
+            if (copy_to_user((struct obj_batch *) arg, &batch, sizeof(batch))) {
+                return -EINVAL;
+            }
+            if (status) {
+                return status;
+            }
+            if (done < batch.count) {
+                return -EACCES;
+            }
+            break;
+
+        /* Pop up to `count` (approximately) minimum or maximum priority items */
+        case PB2_EXTRACT_MIN_N:
+        case PB2_EXTRACT_MAX_N:
+
+            status = copy_from_user(&batch, (struct obj_batch *) arg, sizeof(batch));
+            if (status) {
+                return -EINVAL;
+            }
+            if (batch.count < 0) {
+                return -EINVAL;
+            }
+
+            for (done = 0; done < batch.count; done += n) {
+                n = relaxed_pop(queue_list, relaxed, items, 
+                    min_t(size_t, batch.count - done, RELAXED_CHUNK), 
+                    cmd == PB2_EXTRACT_MAX_N);
+                if (n == 0) {
+                    if (done > 0) {
+                        break;
+                    }
+                    status = relaxed_wait(file, queue_list, relaxed);
+                    if (status) {
+                        return status;
+                    }
+                    continue;
+                }
+
+                status = copy_to_user(
+                    u64_to_user_ptr(batch.items) + done * sizeof(struct item_t), 
+                    items, n * sizeof(struct item_t)
+                );
+                if (status) {
+                    /* Put the items back rather than losing them */
+                    relaxed_push(queue_list, relaxed, items, n);
+                    if (done == 0) {
+                        return -EINVAL;
+                    }
+                    /* Earlier chunks already left the queue, report them */
+                    break;
+                }
+            }
+
+            batch.done = done;
+            status = copy_to_user((struct obj_batch *) arg, &batch, sizeof(batch));
+            if (status) {
+                return -EINVAL;
+            }
+            break;
+
+        /* Retention does not touch the shards */
+        case PB2_SET_RETAIN: ;
+
+            struct obj_retain obj_retain;
+            status = copy_from_user(&obj_retain, (struct obj_retain *) arg, sizeof(obj_retain));
+            if (status) {
+                return -EINVAL;
+            }
+
+            return set_retain(queue_list, obj_retain.seconds);
+
+        default:
+            /* Per-file item value cache, peeks and rings need the strict mode */
+            debug_printk(
+                KERN_ALERT DEVICE_NAME " <qioctl@%d>: Command not supported by "
+                "relaxed queues!\n", current->pid
+            );
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Allocate the shared submission and completion rings of a file
+ * 
+ * @param queue_file: File the rings belong to
+ * @param entries: Number of slots in each ring, a power of two
+ * 
+ * @return Number of bytes to be mapped by userspace (if successful)
+ *         -EINVAL
+ *             - when `entries` is not a power of two in range
+ *         -EBUSY
+ *             - when the rings are already set up
+ *         -ENOMEM
+ *             - ring allocation failed
+ */
+static int setup_ring(struct queue_file *queue_file, u32 entries) {
+    if (entries == 0 || entries > MAX_RING_ENTRIES || !is_power_of_2(entries)) {
+        return -EINVAL;
+    }
+
+    if (queue_file->ring != NULL) {
+        return -EBUSY;
+    }
+
+    size_t sq_off = sizeof(struct obj_ring);
+    size_t cq_off = sq_off + entries * sizeof(struct obj_sqe);
+    size_t size   = PAGE_ALIGN(cq_off + entries * sizeof(struct obj_cqe));
+
+    /* Zeroed and suitable for `remap_vmalloc_range` */
+    struct obj_ring *ring = vmalloc_user(size);
+    if (ring == NULL) {
+        debug_printk(
+            KERN_ALERT "<setup_ring@%d>: Failed to allocate rings of %u "
+            "entries!\n", current->pid, entries
+        );
+        return -ENOMEM;
+    }
+
+    ring->entries = entries;
+    ring->sq_off  = sq_off;
+    ring->cq_off  = cq_off;
+
+    queue_file->ring_entries = entries;
+    smp_store_release(&queue_file->ring, ring);
+    return size;
+}
+
+
+/**
+ * @brief Consume every published submission and post its completion
+ * 
+ * The shared page is writable by userspace, so the module keeps its own
+ * `sq_head` and `cq_tail` in the file and only publishes them to the page;
+ * `sq_tail`, `cq_head` and the submissions are read once and validated.
+ * Processing stops when the completion ring is full.
+ * 
+ * @param queue_file: File with rings set up
+ * @param queue_list: Queue the file is attached to, locked
+ * 
+ * @return Number of submissions consumed
+ */
+static int process_ring(struct queue_file *queue_file, struct queue_list *queue_list) {
+    struct obj_ring *ring = queue_file->ring;
+    struct obj_sqe *sqes  = (void *) ring + sizeof(struct obj_ring);
+    struct obj_cqe *cqes  = (void *) &sqes[queue_file->ring_entries];
+    u32 mask = queue_file->ring_entries - 1;
+
+    u32 sq_head = queue_file->sq_head;
+    u32 cq_tail = queue_file->cq_tail;
+    u32 sq_tail = smp_load_acquire(&ring->sq_tail);
+    u32 cq_head = smp_load_acquire(&ring->cq_head);
+    int done = 0;
+
+    struct priority_queue *queue = queue_list->queue;
+
+    while (sq_head != sq_tail) {
+        if (cq_tail - cq_head >= queue_file->ring_entries) {
+            /* Completion ring is full, userspace must reap first */
+            break;
+        }
+
+        struct obj_sqe sqe;
+        memcpy(&sqe, &sqes[sq_head & mask], sizeof(sqe));
+
+        struct obj_cqe cqe = {
+            .result    = 0,
+            .user_data = sqe.user_data,
+        };
+
+        switch (sqe.opcode) {
+            case PB2_OP_INSERT:
+                if (sqe.priority <= 0) {
+                    cqe.result = -EINVAL;
+                    break;
+                }
+                cqe.result = push(queue, (struct item_t) {
+                    .value    = sqe.value,
+                    .priority = sqe.priority,
+                }, NULL);
+                break;
+
+            case PB2_OP_EXTRACT_MIN:
+            case PB2_OP_EXTRACT_MAX:
+                if (sqe.opcode == PB2_OP_EXTRACT_MAX && !tracks_max(queue)) {
+                    cqe.result = -EINVAL;
+                    break;
+                }
+                if (extract_n(queue, 1, sqe.opcode == PB2_OP_EXTRACT_MAX) == 0) {
+                    cqe.result = -EACCES;
+                    break;
+                }
+                cqe.value    = queue->items[queue->count].value;
+                cqe.priority = queue->items[queue->count].priority;
+                break;
+
+            default:
+                cqe.result = -EINVAL;
+        }
+
+        cqes[cq_tail & mask] = cqe;
+        sq_head++;
+        cq_tail++;
+        done++;
+    }
+
+    queue_file->sq_head = sq_head;
+    queue_file->cq_tail = cq_tail;
+
+    /* Publish completions before letting userspace reuse submission slots */
+    smp_store_release(&ring->cq_tail, cq_tail);
+    smp_store_release(&ring->sq_head, sq_head);
+    return done;
+}
+
+
+/**
+ * @brief Wait until the queue attached to the file has an item. Called with
+ * the queue lock held, which is dropped while sleeping.
+ * 
+ * @param file: File being read, for its O_NONBLOCK flag
+ * @param queue_list: Queue the file is attached to, locked
+ * 
+ * Sleepers wait for `events` to move rather than looking at the queue
+ * itself, which may only be touched under the lock.
+ * 
+ * @return 0 (if the queue is not empty)
+ *         -EAGAIN
+ *             - when the queue is empty and the file is non-blocking
+ *         -ERESTARTSYS
+ *             - when interrupted by a signal
+ *         -EACCES
+ *             - when the queue was split by PB2_SET_RELAXED while sleeping
+ */
+static int wait_for_items(struct file *file, struct queue_list *queue_list) {
+    while (queue_list->queue->count == 0) {
+        if (file->f_flags & O_NONBLOCK) {
+            this_cpu_inc(queue_list->stats->underflows);
+            return -EAGAIN;
+        }
+
+        unsigned int events = queue_list->events;
+        mutex_unlock(&queue_list->lock);
+        int status = wait_event_interruptible(
+            queue_list->wait, READ_ONCE(queue_list->events) != events
+        );
+        mutex_lock(&queue_list->lock);
+
+        if (status) {
+            return -ERESTARTSYS;
+        }
+        if (queue_list->queue == NULL) {
+            /* PB2_SET_RELAXED split it meanwhile */
+            return -EACCES;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Wake up readers and pollers after an operation on the queue. Called
+ * with the queue lock held.
+ */
+static void queue_changed(struct queue_list *queue_list) {
+    WRITE_ONCE(queue_list->events, queue_list->events + 1);
+    if (queue_list->queue != NULL) {
+        WRITE_ONCE(queue_list->stat_count, queue_list->queue->count);
+        WRITE_ONCE(queue_list->stat_capacity, queue_list->queue->capacity);
+    }
+    if (wq_has_sleeper(&queue_list->wait)) {
+        wake_up_interruptible(&queue_list->wait);
+    }
+
+    struct queue_notify *notify = queue_list->notify;
+    if (notify != NULL && queue_list->queue != NULL) {
+        size_t count = queue_list->queue->count;
+        notify_count(queue_list, notify->count, count);
+        notify->count = count;
+    }
+}
+
+
+/**
+ * @brief Replace the watermark notifications of a queue. Called with the
+ * lock of `queue_list` held, on a strict queue.
+ * 
+ * @param queue_list: `queue_list` instance with an initialized queue
+ * @param obj_notify: Eventfds (negative to leave an event out) and watermarks
+ * 
+ * @return 0 (if successful)
+ *         -EBADF, -EINVAL
+ *             - when an fd is not an eventfd
+ *         -EINVAL
+ *             - negative high or non-positive low watermark
+ *         -ENOMEM
+ *             - allocation failed
+ */
+static int set_notify(struct queue_list *queue_list, struct obj_notify *obj_notify) {
+    int32_t fds[NOTIFY_EVENTS] = {
+        [NOTIFY_NONEMPTY] = obj_notify->nonempty_fd,
+        [NOTIFY_HIGH]     = obj_notify->high_fd,
+        [NOTIFY_LOW]      = obj_notify->low_fd,
+    };
+    struct queue_notify *notify = NULL;
+    int i;
+
+    if ((fds[NOTIFY_HIGH] >= 0 && obj_notify->high < 0) || 
+            (fds[NOTIFY_LOW] >= 0 && obj_notify->low <= 0)) {
+        debug_printk(
+            KERN_ALERT "<set_notify@%d>: Watermarks should be high >= 0 and "
+            "low >= 1, got %d and %d!\n", current->pid, obj_notify->high, obj_notify->low
+        );
+        return -EINVAL;
+    }
+
+    for (i = 0; i < NOTIFY_EVENTS; i++) {
+        if (fds[i] < 0) {
+            continue;
+        }
+        if (notify == NULL) {
+            notify = kzalloc(sizeof(*notify), GFP_KERNEL);
+            if (notify == NULL) {
+                return -ENOMEM;
+            }
+        }
+
+        struct eventfd_ctx *ctx = eventfd_ctx_fdget(fds[i]);
+        if (IS_ERR(ctx)) {
+            free_notify(notify);
+            return PTR_ERR(ctx);
+        }
+        notify->ctx[i] = ctx;
+    }
+
+    if (notify != NULL) {
+        notify->high  = obj_notify->high;
+        notify->low   = obj_notify->low;
+        notify->count = queue_list->queue->count;
+    }
+    free_notify(queue_list->notify);
+    queue_list->notify = notify;
+    return 0;
+}
+
+
+/**
+ * @brief Release the eventfds of watermark notifications
+ * 
+ * @param notify: Pointer to queue_notify structure, may be NULL
+ */
+static void free_notify(struct queue_notify *notify) {
+    int i;
+
+    if (notify == NULL) {
+        return;
+    }
+    for (i = 0; i < NOTIFY_EVENTS; i++) {
+        if (notify->ctx[i] != NULL) {
+            eventfd_ctx_put(notify->ctx[i]);
+        }
+    }
+    kfree(notify);
+}
+
+
+/**
+ * @brief Signal the watermarks crossed by a change of the number of items
+ * 
+ * @param queue_list: `queue_list` instance whose count changed
+ * @param old: Number of items before the change
+ * @param new: Number of items after the change
+ */
+static void notify_count(struct queue_list *queue_list, size_t old, size_t new) {
+    struct queue_notify *notify = queue_list->notify;
+
+    if (notify == NULL || old == new) {
+        return;
+    }
+    if (notify->ctx[NOTIFY_NONEMPTY] && old == 0) {
+        notify_signal(notify->ctx[NOTIFY_NONEMPTY]);
+    }
+    if (notify->ctx[NOTIFY_HIGH] && old <= notify->high && new > notify->high) {
+        notify_signal(notify->ctx[NOTIFY_HIGH]);
+    }
+    if (notify->ctx[NOTIFY_LOW] && old >= notify->low && new < notify->low) {
+        notify_signal(notify->ctx[NOTIFY_LOW]);
+    }
+}
+
+
+/**
+ * @brief Write data to priority queue
+ * 
+ * Once the queue is initialized, a 4-byte write is an item value or, when a
+ * value is cached, its priority. A write of one or more whole `struct
+ * obj_item` records (8 bytes each) inserts that many items, as many as fit in
+ * the queue. `writev` issues one such write per iovec.
+ * 
+ * @return Number of bytes wrote (if successful)
+ *         -EACCES
+ *             - priority queue overflow
+ *         -EINVAL
+ *             - invalid input type for item value/priority
+ *             - invalid buffer length
+ *             - out of range queue size
+ *         -ENOMEM
+ *             - queue allocation failed
+ */
+static ssize_t qwrite(struct file *file, const char *buf, size_t count, loff_t *pos) {
+    if (!buf || !count) return -EINVAL; /* check buf is not null and count is non-zero */
+
+    /* Get the queue_list attached to the file */
+    struct queue_file *queue_file = file->private_data;
+    struct relaxed_queue *relaxed;
+    u64 start = ktime_get_ns();
+    ssize_t ret;
+
+    struct queue_list *queue_list = lock_file_queue(queue_file, &relaxed);
+    if (relaxed != NULL) {
+        ret = write_relaxed(queue_list, relaxed, buf, count);
+    } else {
+        ret = write_items(queue_file, queue_list, buf, count);
+        queue_changed(queue_list);
+        mutex_unlock(&queue_list->lock);
+    }
+
+    if (ret >= 0) {
+        note_latency(queue_list, 0, start);
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Internal helper subroutine for `qwrite`, called with the queue lock
+ * held.
+ */
+static ssize_t write_items(struct queue_file *queue_file, struct queue_list *queue_list, 
+                           const char *buf, size_t count) {
+    int buf_len = count < 256 ? count : 256;
+
+    if (queue_list->queue != NULL && queue_list->queue->arena != NULL) {
+        debug_printk(
+            KERN_ALERT DEVICE_NAME " <write@%d>: Queue carries payloads, use "
+            "PB2_INSERT_PAYLOAD!\n", current->pid
+        );
+        return -EINVAL;
+    }
+
+    if (queue_list->queue != NULL && count % sizeof(struct item_t) == 0) {
+        /**
+         * Whole `struct obj_item` records, each carrying both the value and
+         * the priority of an item. As many records as fit in the queue are
+         * copied straight into the free tail of the heap array.
+         */
+        if (queue_file->is_item_value_cached) {
+            debug_printk(
+                KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, "
+                "expected item priority (4 bytes)!\n", current->pid
+            );
+            return -EINVAL;
+        }
+
+        struct priority_queue *queue = queue_list->queue;
+        size_t n = reserve_items(queue, count / sizeof(struct item_t));
+        this_cpu_add(queue_list->stats->overflows, count / sizeof(struct item_t) - n);
+        if (n == 0) {
+            debug_printk(KERN_ALERT DEVICE_NAME " <write@%d>: Overflow in the queue!\n", 
+                current->pid);
+            return -EACCES;
+        }
+
+        if (copy_from_user(&queue->items[queue->count], buf, n * sizeof(struct item_t))) {
+            return -EINVAL;
+        }
+
+        size_t i;
+        for (i = 0; i < n; i++) {
+            if (queue->items[queue->count + i].priority <= 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, "
+                    "priority must be a positive integer!\n", current->pid
+                );
+                return -EINVAL;
+            }
+            if (check_prio(queue, queue->items[queue->count + i].priority)) {
+                /* Error will be reported in `check_prio` method */
+                return -EINVAL;
+            }
+        }
+
+        push_appended(queue, n);
+        return n * sizeof(struct item_t);
+    }
+
+    if (queue_list->queue != NULL) {
+        /**
+         * `queue_list` is already initialized. Hence, need to write an integer
+         * (4-bytes). It may be item's value or priority. We distinguish the two
+         * cases using `item_value_cache` and `is_item_value_cached`.
+         */
+
+        /* Check if received an integer (4-bytes)? */
+        if (buf_len != 4) {
+            debug_printk(
+                KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, "
+                "expected an integer (4 bytes)!\n", current->pid
+            );
+            return -EINVAL;
+        }
+
+        int32_t num;
+        memcpy(&num, buf, sizeof(char) * buf_len);
+        debug_printk(KERN_INFO DEVICE_NAME " <write@%d>: Received %d.\n", current->pid, num);
+
+        if (queue_file->is_item_value_cached) {
+            /* `num` will be treated as priority for cached item value */
+
+            /* Check if `num` > 0 as priority is a positive integer */
+            if (num <= 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <write@%d>: Invalid argument, "
+                    "priority must be a positive integer!\n", current->pid
+                );
+                return -EINVAL;
+            }
+
+            /* Prepare item to push to priority queue */
+            struct item_t new_item = (struct item_t) {
+                .value    = queue_file->item_value_cache,
+                .priority = num,
+            };
+
+            int status = push(queue_list->queue, new_item, NULL);
+            if (status < 0) {
+                /* Overflow in priority queue */
+                return status;
+            }
+
+            debug_printk(KERN_INFO DEVICE_NAME " <write@%d>: Item inserted in queue.\n", current->pid);
+            queue_file->is_item_value_cached = 0;
+        } else {
+            /* `num` is treated as item value and will be cached for the process */
+            queue_file->item_value_cache = num;
+            queue_file->is_item_value_cached = 1;
+            debug_printk(
+                KERN_INFO DEVICE_NAME " <write@%d>: Item value cached, waiting for "
+                "item priority.\n", current->pid
+            );
+        }
+
+        return sizeof(num);
+    }
+
+    /* `queue_list` for current process is not initialized */
+
+    /* Check if received only one byte of data */
+    if (buf_len != 1) {
+        debug_printk(
+            KERN_ALERT DEVICE_NAME "<write@%d>: Expected one byte of data, "
+            "got %d byte(s)!\n", current->pid, buf_len
+        );
+        return -EINVAL;
+    }
+
+    size_t queue_size = buf[0];
+    /* Check if `queue_size` is in valid range */
+
+    if (!(queue_size > 0 && queue_size <= MAX_PQ_CAPACITY)) {
+        debug_printk(
+            KERN_ALERT DEVICE_NAME "<write@%d>: Priority-queue size "
+            "should be in range [1, %d], got %d!", current->pid, MAX_PQ_CAPACITY, 
+            queue_size
+        );
+        return -EINVAL;
+    }
+
+    /* Allocate priority queue for current process */
+    queue_list->queue = create_queue(queue_size, queue_list);
+    if (queue_list->queue == NULL) {
+        /* Error will be reported in `create_queue` method */
+        return -ENOMEM;
+    }
+    
+    return buf_len;
+}
+
+
+/**
+ * @brief Read from current process's queue, extracting minimum priority items
+ * 
+ * A 4-byte read returns the value of the minimum priority item. A read of one
+ * or more whole `struct obj_item` records (8 bytes each) returns as many
+ * (value, priority) pairs, in increasing order of priority, as fit in the
+ * buffer and are present in the queue. Vectored reads are filled the same
+ * way, records may straddle iovec boundaries. When the queue is empty, the
+ * read sleeps until an item is pushed, unless the file is non-blocking.
+ * 
+ * @return Number of bytes read (if successful)
+ *         -EINVAL
+ *             - when number of bytes requested is neither 4 nor a multiple of 8
+ *         -EAGAIN
+ *             - when the queue is empty and the file is non-blocking
+ *         -ERESTARTSYS
+ *             - when interrupted by a signal while waiting for an item
+ *         -EACCES
+ *             - when priority queue is not initialized for the file
+ *             - unable to copy item value to buffer `buf`
+ */
+static ssize_t read_items(struct file *file, struct iov_iter *to) {
+    size_t count = iov_iter_count(to);
+
+    /* Check if count is 4 (bytes) or whole records */
+    if (count == 0 || (count != 4 && count % sizeof(struct item_t) != 0)) {
+        return -EINVAL;
+    }
+
+    /* Fetch priority queue attached to the file */
+    struct queue_file *queue_file = file->private_data;
+    struct queue_list *queue_list = READ_ONCE(queue_file->queue_list);
+
+    u64 start = ktime_get_ns();
+    ssize_t ret;
+
+    struct relaxed_queue *relaxed = lock_queue_list(queue_list);
+    if (relaxed != NULL) {
+        ret = read_relaxed(file, queue_list, relaxed, to);
+    } else {
+        ret = read_locked(file, queue_list, to);
+        queue_changed(queue_list);
+        mutex_unlock(&queue_list->lock);
+    }
+
+    if (ret >= 0) {
+        note_latency(queue_list, 1, start);
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Internal helper subroutine for `read_items`, called with the lock of
+ * `queue_list` held.
+ */
+static ssize_t read_locked(struct file *file, struct queue_list *queue_list, 
+                           struct iov_iter *to) {
+    size_t count = iov_iter_count(to);
+
+    if (queue_list->queue == NULL) {
+        debug_printk(
+            KERN_ALERT DEVICE_NAME " <read@%d>: Priority queue is not "
+            "initialized!\n", current->pid
+        );
+        return -EACCES;
+    }
+
+    release_due(queue_list->queue);
+
+    if (queue_list->queue->arena) {
+        /* Values alone would lose the payloads */
+        debug_printk(
+            KERN_ALERT DEVICE_NAME " <read@%d>: Queue carries payloads, use "
+            "PB2_GET_MIN_PAYLOAD!\n", current->pid
+        );
+        return -EINVAL;
+    }
+
+    /* Sleep until an item is pushed (or fail with -EAGAIN if non-blocking) */
+    int status = wait_for_items(file, queue_list);
+    if (status) {
+        return status;
+    }
+
+    if (count == 4) {
+        int32_t item_value = extract_min(queue_list->queue);
+        if (copy_to_iter(&item_value, sizeof(item_value), to) != sizeof(item_value)) {
+            /* `copy_to_iter` failed */
+            debug_printk(
+                KERN_ALERT DEVICE_NAME " <read@%d>: copy_to_user failed!\n", 
+                current->pid
+            );
+            return -EACCES;
+        }
+        return sizeof(item_value);
+    }
+
+    struct priority_queue *queue = queue_list->queue;
+    size_t n = extract_n(queue, count / sizeof(struct item_t), 0);
+    size_t copied = copy_to_iter(&queue->items[queue->count], 
+        n * sizeof(struct item_t), to) / sizeof(struct item_t);
+
+    if (copied < n) {
+        /* Items that did not reach userspace go back to the queue */
+        memmove(&queue->items[queue->count], &queue->items[queue->count + copied],
+            (n - copied) * sizeof(struct item_t));
+        restore_items(queue, n - copied);
+        if (copied == 0) {
+            debug_printk(
+                KERN_ALERT DEVICE_NAME " <read@%d>: copy_to_user failed!\n", 
+                current->pid
+            );
+            return -EACCES;
+        }
+    }
+
+    return copied * sizeof(struct item_t);
+}
+
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+/**
+ * @brief `read`/`readv` entry point, see `read_items`
+ */
+static ssize_t qread_iter(struct kiocb *iocb, struct iov_iter *to) {
+    return read_items(iocb->ki_filp, to);
+}
+#else
+/**
+ * @brief `read` entry point for kernels without `proc_read_iter`, see
+ * `read_items`
+ */
+static ssize_t qread(struct file *file, char *buf, size_t count, loff_t *pos) {
+    struct iovec iov;
+    struct iov_iter to;
+
+    int status = import_single_range(READ, buf, count, &iov, &to);
+    if (status < 0) {
+        return status;
+    }
+    return read_items(file, &to);
+}
+#endif
+
+
+/**
+ * @brief Allocates a new anonymous `queue_list` instance and attaches it to
+ * the file. A process may open the file several times to hold independent
+ * queues, or share queues by name with PB2_ATTACH.
+ * 
+ * @return 0 (if successful)
+ *         -ENOMEM
+ *             - when the `queue_list` instance cannot be allocated
+ */
+static int qopen(struct inode *inode, struct file *file) {
+    struct queue_file *queue_file = (struct queue_file *) 
+        kmem_cache_alloc(queue_file_cache, GFP_KERNEL);
+    if (queue_file == NULL) {
+        return -ENOMEM;
+    }
+
+    *queue_file = (struct queue_file) {
+        .queue_list           = add_queue_list(current->pid),
+        .detached             = NULL,
+        .item_value_cache     = 0,
+        .is_item_value_cached = 0,
+        .ring                 = NULL,
+        .ring_entries         = 0,
+        .sq_head              = 0,
+        .cq_tail              = 0,
+    };
+    if (queue_file->queue_list == NULL) {
+        kmem_cache_free(queue_file_cache, queue_file);
+        return -ENOMEM;
+    }
+
+    file->private_data = queue_file;
+    trace_pqkmod_open(queue_file->queue_list->id, current->pid);
+    print_list();
+    return 0;
+}
+
+
+/**
+ * @brief Drops the file's references to its priority queues, deallocating
+ * those no other file is attached to
+ */
+static int qrelease(struct inode *inode, struct file *file) {
+    struct queue_file *queue_file = file->private_data;
+
+    trace_pqkmod_release(queue_file->queue_list->id, current->pid);
+    put_queue_list(queue_file->queue_list);
+    if (queue_file->detached != NULL) {
+        put_queue_list(queue_file->detached);
+    }
+    vfree(queue_file->ring);
+    kmem_cache_free(queue_file_cache, queue_file);
+
+    print_list();
+    return 0;
+}
+
+
+/**
+ * @brief Support for ioctl calls to manipulate priority queue
+ */
+static long qioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    /* Fetch priority queue attached to the file */
+    struct queue_file *queue_file = file->private_data;
+
+    if (cmd == PB2_ATTACH) {
+        /* Changes the attached queue, so it is not run under a queue lock */
+        struct obj_attach attach;
+        if (copy_from_user(&attach, (struct obj_attach *) arg, sizeof(attach))) {
+            return -EINVAL;
+        }
+
+        attach.name[PB2_NAME_LEN - 1] = '\0';
+        if (attach.name[0] == '\0') {
+            return -EINVAL;
+        }
+        return attach_queue_list(queue_file, attach.name);
+    }
+
+    struct relaxed_queue *relaxed;
+    u64 start = ktime_get_ns();
+    long ret;
+
+    struct queue_list *queue_list = lock_file_queue(queue_file, &relaxed);
+    if (relaxed != NULL) {
+        ret = ioctl_relaxed(file, queue_list, relaxed, cmd, arg);
+    } else {
+        ret = ioctl_locked(file, queue_list, cmd, arg);
+        queue_changed(queue_list);
+        mutex_unlock(&queue_list->lock);
+    }
+
+    if (ret >= 0) {
+        switch (cmd) {
+            case PB2_INSERT_PRIO:
+            case PB2_INSERT_BATCH:
+            case PB2_INSERT_HANDLE:
+            case PB2_INSERT_PAYLOAD:
+            case PB2_INSERT_DELAYED:
+                note_latency(queue_list, 0, start);
+                break;
+            case PB2_GET_MIN:
+            case PB2_GET_MAX:
+            case PB2_EXTRACT_MIN_N:
+            case PB2_EXTRACT_MAX_N:
+            case PB2_DELETE:
+            case PB2_GET_MIN_PAYLOAD:
+            case PB2_GET_MAX_PAYLOAD:
+                note_latency(queue_list, 1, start);
+                break;
+        }
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Internal helper subroutine for `qioctl`, called with the lock of
+ * `queue_list` held.
+ */
+static long ioctl_locked(struct file *file, struct queue_list *queue_list, 
+                         unsigned int cmd, unsigned long arg) {
+    struct queue_file *queue_file = file->private_data;
+    int status;
+    int32_t num, item_value;
+
+    if (queue_list->queue != NULL) {
+        /* Items that came due are extractable, whether or not the work ran */
+        release_due(queue_list->queue);
+    }
+
+    if (queue_list->queue != NULL && queue_list->queue->arena != NULL && 
+            !payload_cmd(cmd)) {
+        debug_printk(
+            KERN_ALERT DEVICE_NAME " <qioctl@%d>: Command not supported by "
+            "queues carrying payloads!\n", current->pid
+        );
+        return -EINVAL;
+    }
+
+    switch(cmd) {
+
+        /* Initialize queue for the current process, or resize it keeping its items */
+        case PB2_SET_CAPACITY: ;
+
+            int32_t queue_size;
+            status = copy_from_user(&queue_size, (int32_t *) arg, sizeof(int32_t));
+            if (status) {
+                return -EINVAL;
+            }
+
+            if (queue_size <= 0 || queue_size > MAX_PQ_CAPACITY) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME "<qioctl::PB2_SET_CAPACITY@%d>: "
+                    "Priority-queue size should be in range [1, %d], got %d!",
+                    current->pid, MAX_PQ_CAPACITY, queue_size
+                );
+                return -EINVAL;
+            }
+
+            if (queue_list->queue != NULL) {
+                status = set_capacity(queue_list->queue, queue_size);
+                if (status) {
+                    /* Error will be reported in `set_capacity` method */
+                    return status;
+                }
+            } else {
+                queue_list->queue = create_queue(queue_size, queue_list);
+                if (queue_list->queue == NULL) {
+                    /* Error will be reported in `create_queue` method */
+                    return -ENOMEM;
+                }
+            }
+
+            debug_printk(
+                KERN_INFO DEVICE_NAME " <qioctl::PB2_SET_CAPACITY@%d>: Queue "
+                "capacity set to %d for current process!\n", 
+                current->pid, queue_size
+            );
+
+            break;
+
+        /* Initialize the queue with the engine of choice */
+        case PB2_CREATE: ;
+
+            struct obj_create obj_create;
+            status = copy_from_user(&obj_create, (struct obj_create *) arg, sizeof(obj_create));
+            if (status) {
+                return -EINVAL;
+            }
+
+            if (queue_list->queue != NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_CREATE@%d>: Queue is "
+                    "already initialized!\n", current->pid
+                );
+                return -EBUSY;
+            }
+
+            if (obj_create.capacity <= 0 || obj_create.capacity > MAX_PQ_CAPACITY) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_CREATE@%d>: "
+                    "Priority-queue size should be in range [1, %d], got %d!\n",
+                    current->pid, MAX_PQ_CAPACITY, obj_create.capacity
+                );
+                return -EINVAL;
+            }
+
+            struct priority_queue *created = create_queue(obj_create.capacity, queue_list);
+            if (created == NULL) {
+                /* Error will be reported in `create_queue` method */
+                return -ENOMEM;
+            }
+
+            status = set_engine(created, obj_create.engine, obj_create.range);
+            if (status) {
+                free_queue(created);
+                return status;
+            }
+            queue_list->queue = created;
+            break;
+
+        /* Cache item value in the queue */
+        case PB2_INSERT_INT:
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            if (queue_file->is_item_value_cached) {
+                /* Item value is already cached */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: Item "
+                    "value is already cached for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            status = copy_from_user(&num, (int32_t *) arg, sizeof(int32_t));
+            if (status) {
+                return -EINVAL;
+            }
+
+            debug_printk(
+                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: Received "
+                "item value %d!\n", current->pid, num
+            );
+
+            queue_file->item_value_cache = num;
+            queue_file->is_item_value_cached = 1;
+
+            debug_printk(
+                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: Item value"
+                " cached, waiting for item priority.\n", current->pid
+            );
+
+            break;
+
+        /* Get item priority and push item in the queue */
+        case PB2_INSERT_PRIO:
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            if (queue_file->is_item_value_cached == 0) {
+                /* Item value is not cached */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: No "
+                    "item value cached for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            status = copy_from_user(&num, (int32_t *) arg, sizeof(int32_t));
+            if (status) {
+                return -EINVAL;
+            }
+
+            if (num <= 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: "
+                    "Invalid argument, priority must be a positive integer!\n", 
+                    current->pid
+                );
+                return -EINVAL;
+            }
+
+            debug_printk(
+                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: Received "
+                "item priority %d!\n", current->pid, num
+            );
+
+            /* Prepare item to push to priority queue */
+            struct item_t new_item = (struct item_t) {
+                .value    = queue_file->item_value_cache,
+                .priority = num,
+            };
+
+            status = push(queue_list->queue, new_item, NULL);
+            if (status < 0) {
+                /* Overflow in priority queue */
+                return status;
+            }
+
+            debug_printk(
+                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: Item "
+                "inserted in queue.\n", current->pid
+            );
+            queue_file->is_item_value_cached = 0;
+
+            break;
+
+        /* Get queue information */
+        case PB2_GET_INFO:
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_INFO@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            struct obj_info obj_info;
+            obj_info.prio_que_size = queue_list->queue->count;
+            obj_info.capacity      = queue_list->queue->capacity;
+
+            status = copy_to_user(
+                (struct obj_info *) arg, &obj_info, sizeof(struct obj_info)
+            );
+            if (status) {
+                return -EINVAL;
+            }
+            break;
+        
+        /* Get minimum priority item */
+        case PB2_GET_MIN:
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_MIN@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            status = wait_for_items(file, queue_list);
+            if (status) {
+                return status;
+            }
+
+            item_value = extract_min(queue_list->queue);
+            status = copy_to_user((int32_t *) arg, &item_value, sizeof(int32_t));
+            if (status) {
+                return -EINVAL;
+            }
+
+            break;
+
+        /* Get maximum priority item */
+        case PB2_GET_MAX:
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_MAX@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            if (!tracks_max(queue_list->queue)) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_MAX@%d>: Radix "
+                    "queues only extract minimums!\n", current->pid
+                );
+                return -EINVAL;
+            }
+
+            status = wait_for_items(file, queue_list);
+            if (status) {
+                return status;
+            }
+
+            item_value = extract_max(queue_list->queue);
+            status = copy_to_user((int32_t *) arg, &item_value, sizeof(int32_t));
+            if (status) {
+                return -EINVAL;
+            }
+            break;
+
+        /* Read minimum or maximum priority item without removing it */
+        case PB2_PEEK_MIN:
+        case PB2_PEEK_MAX:
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_PEEK@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            if (cmd == PB2_PEEK_MAX && !tracks_max(queue_list->queue)) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_PEEK@%d>: Radix "
+                    "queues only track their minimum!\n", current->pid
+                );
+                return -EINVAL;
+            }
+
+            struct item_t *item = cmd == PB2_PEEK_MIN ? 
+                peek_min(queue_list->queue) : peek_max(queue_list->queue);
+            if (item == NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_PEEK@%d>: No item "
+                    "present in priority queue!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            struct obj_item obj_item = {
+                .value    = item->value,
+                .priority = item->priority,
+            };
+            if (queue_list->queue->arena) {
+                /* The item only holds the slot of its record */
+                obj_item.value = arena_slot(queue_list->queue->arena, item->value)->value;
+            }
+            status = copy_to_user(
+                (struct obj_item *) arg, &obj_item, sizeof(struct obj_item)
+            );
+            if (status) {
+                return -EINVAL;
+            }
+            break;
+
+        /* Push an array of (value, priority) pairs in one call */
+        case PB2_INSERT_BATCH: ;
+
+            struct obj_batch batch;
+            status = copy_from_user(&batch, (struct obj_batch *) arg, sizeof(batch));
+            if (status) {
+                return -EINVAL;
+            }
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_BATCH@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            if (batch.count < 0) {
+                return -EINVAL;
+            }
+
+            /**
+             * Items are copied straight into the free tail of the heap array,
+             * and only become part of the queue once `push_appended` runs.
+             * Items that do not fit in the capacity are not copied.
+             */
+            BUILD_BUG_ON(sizeof(struct item_t) != sizeof(struct obj_item));
+            struct priority_queue *queue = queue_list->queue;
+            size_t n = reserve_items(queue, batch.count);
+            this_cpu_add(queue_list->stats->overflows, batch.count - n);
+
+            status = copy_from_user(
+                &queue->items[queue->count], u64_to_user_ptr(batch.items), 
+                n * sizeof(struct item_t)
+            );
+            if (status) {
+                return -EINVAL;
+            }
+
+            size_t i;
+            for (i = 0; i < n; i++) {
+                if (queue->items[queue->count + i].priority <= 0) {
+                    debug_printk(
+                        KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_BATCH@%d>: "
+                        "Invalid argument, priority of item %zu must be a "
+                        "positive integer!\n", current->pid, i
+                    );
+                    return -EINVAL;
+                }
+                if (check_prio(queue, queue->items[queue->count + i].priority)) {
+                    /* Error will be reported in `check_prio` method */
+                    return -EINVAL;
+                }
+            }
 
-    int status;
-    int32_t num, item_value;
+            push_appended(queue, n);
 
-    switch(cmd) {
+            debug_printk(
+                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_BATCH@%d>: %zu of %d "
+                "items inserted in queue.\n", current->pid, n, batch.count
+            );
 
-        /* (Re)Initialize queue for the current process */
-        case PB2_SET_CAPACITY: ;
+            /* Report how many items made it, the rest overflowed */
+            batch.done = n;
+            status = copy_to_user((struct obj_batch *) arg, &batch, sizeof(batch));
+            if (status) {
+                return -EINVAL;
+            }
+            if (n < batch.count) {
+                return -EACCES;
+            }
+            break;
 
-            int32_t queue_size;
-            status = copy_from_user(&queue_size, (int32_t *) arg, sizeof(int32_t));
+        /* Pop up to `count` minimum or maximum priority items in one call */
+        case PB2_EXTRACT_MIN_N:
+        case PB2_EXTRACT_MAX_N: ;
+
+            status = copy_from_user(&batch, (struct obj_batch *) arg, sizeof(batch));
             if (status) {
                 return -EINVAL;
             }
 
-            if (queue_size <= 0 || queue_size > MAX_PQ_CAPACITY) {
-                printk(
-                    KERN_ALERT DEVICE_NAME "<qioctl::PB2_SET_CAPACITY@%d>: "
-                    "Priority-queue size should be in range [1, 100], got %d!",
-                    current->pid, queue_size
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_EXTRACT_N@%d>: No "
+                    "queue allocated for current process!\n", current->pid
                 );
+                return -EACCES;
+            }
+
+            if (batch.count < 0 || 
+                    (cmd == PB2_EXTRACT_MAX_N && !tracks_max(queue_list->queue))) {
                 return -EINVAL;
             }
 
-            free_queue(queue_list->queue);
-            queue_list->queue = create_queue(queue_size);
-            if (queue_list->queue == NULL) {
-                /* Error will be reported in `create_queue` method */
-                return -ENOMEM;
+            if (batch.count > 0) {
+                status = wait_for_items(file, queue_list);
+                if (status) {
+                    return status;
+                }
             }
 
-            printk(
-                KERN_INFO DEVICE_NAME " <qioctl::PB2_SET_CAPACITY@%d>: New "
-                "queue of capacity %d allocated for current process!\n", 
-                current->pid, queue_size
+            queue = queue_list->queue;
+            n = extract_n(queue, batch.count, cmd == PB2_EXTRACT_MAX_N);
+
+            status = copy_to_user(
+                u64_to_user_ptr(batch.items), &queue->items[queue->count], 
+                n * sizeof(struct item_t)
             );
+            if (status) {
+                /* Put the items back rather than losing them */
+                restore_items(queue, n);
+                return -EINVAL;
+            }
 
+            batch.done = n;
+            status = copy_to_user((struct obj_batch *) arg, &batch, sizeof(batch));
+            if (status) {
+                return -EINVAL;
+            }
             break;
 
-        /* Cache item value in the queue */
-        case PB2_INSERT_INT:
+        /* Allocate the shared submission and completion rings */
+        case PB2_RING_SETUP: ;
 
             if (queue_list->queue == NULL) {
                 /* Queue is not initialized for this process */
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: No "
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_RING_SETUP@%d>: No "
                     "queue allocated for current process!\n", current->pid
                 );
                 return -EACCES;
             }
 
-            if (queue_list->is_item_value_cached) {
-                /* Item value is already cached */
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: Item "
-                    "value is already cached for current process!\n", current->pid
-                );
-                return -EACCES;
+            struct obj_ring_setup ring_setup;
+            status = copy_from_user(&ring_setup, (struct obj_ring_setup *) arg, 
+                sizeof(ring_setup));
+            if (status) {
+                return -EINVAL;
             }
 
-            status = copy_from_user(&num, (int32_t *) arg, sizeof(int32_t));
+            if (ring_setup.entries <= 0) {
+                return -EINVAL;
+            }
+
+            status = setup_ring(queue_file, ring_setup.entries);
+            if (status < 0) {
+                return status;
+            }
+
+            ring_setup.size = status;
+            status = copy_to_user((struct obj_ring_setup *) arg, &ring_setup, 
+                sizeof(ring_setup));
             if (status) {
                 return -EINVAL;
             }
+            break;
 
-            printk(
-                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: Received "
-                "item value %d!\n", current->pid, num
-            );
+        /* Split the queue into shards for relaxed, scalable operations */
+        case PB2_SET_RELAXED: ;
 
-            queue_list->item_value_cache = num;
-            queue_list->is_item_value_cached = 1;
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_SET_RELAXED@%d>: No "
+                    "queue allocated for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
 
-            printk(
-                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_INT@%d>: Item value"
-                " cached, waiting for item priority.\n", current->pid
-            );
+            struct obj_relaxed obj_relaxed;
+            status = copy_from_user(&obj_relaxed, (struct obj_relaxed *) arg, 
+                sizeof(obj_relaxed));
+            if (status) {
+                return -EINVAL;
+            }
 
-            break;
+            return set_relaxed(queue_list, &obj_relaxed);
 
-        /* Get item priority and push item in the queue */
-        case PB2_INSERT_PRIO:
+        /* Track the items of the queue by handle */
+        case PB2_SET_INDEXED: ;
 
             if (queue_list->queue == NULL) {
                 /* Queue is not initialized for this process */
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: No "
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_SET_INDEXED@%d>: No "
                     "queue allocated for current process!\n", current->pid
                 );
                 return -EACCES;
             }
 
-            if (queue_list->is_item_value_cached == 0) {
-                /* Item value is not cached */
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: No "
-                    "item value cached for current process!\n", current->pid
+            struct obj_indexed obj_indexed;
+            status = copy_from_user(&obj_indexed, (struct obj_indexed *) arg, 
+                sizeof(obj_indexed));
+            if (status) {
+                return -EINVAL;
+            }
+
+            return set_indexed(queue_list->queue, obj_indexed.upsert != 0);
+
+        /* Insert an item and report its handle */
+        case PB2_INSERT_HANDLE: ;
+
+            struct obj_handle obj_handle;
+            if (queue_list->queue == NULL || queue_list->queue->index == NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_HANDLE@%d>: No "
+                    "indexed queue for current process!\n", current->pid
                 );
-                return -EACCES;
+                return -EINVAL;
             }
 
-            status = copy_from_user(&num, (int32_t *) arg, sizeof(int32_t));
+            status = copy_from_user(&obj_handle, (struct obj_handle *) arg, sizeof(obj_handle));
             if (status) {
                 return -EINVAL;
             }
 
-            if (num <= 0) {
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: "
+            if (obj_handle.priority <= 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_HANDLE@%d>: "
                     "Invalid argument, priority must be a positive integer!\n", 
                     current->pid
                 );
                 return -EINVAL;
             }
 
-            printk(
-                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: Received "
-                "item priority %d!\n", current->pid, num
-            );
-
-            /* Prepare item to push to priority queue */
-            struct item_t new_item = (struct item_t) {
-                .value    = queue_list->item_value_cache,
-                .priority = num,
-            };
-
-            status = push(queue_list->queue, new_item);
+            status = push(queue_list->queue, (struct item_t) {
+                .value    = obj_handle.value,
+                .priority = obj_handle.priority,
+            }, &obj_handle.handle);
             if (status < 0) {
                 /* Overflow in priority queue */
                 return status;
             }
 
-            printk(
-                KERN_INFO DEVICE_NAME " <qioctl::PB2_INSERT_PRIO@%d>: Item "
-                "inserted in queue.\n", current->pid
-            );
-            queue_list->is_item_value_cached = 0;
-
+            status = copy_to_user((struct obj_handle *) arg, &obj_handle, sizeof(obj_handle));
+            if (status) {
+                return -EINVAL;
+            }
             break;
 
-        /* Get queue information */
-        case PB2_GET_INFO:
+        /* Change the priority of the item of a handle */
+        case PB2_UPDATE: ;
+
+            long pos;
+            if (queue_list->queue == NULL || queue_list->queue->index == NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_UPDATE@%d>: No "
+                    "indexed queue for current process!\n", current->pid
+                );
+                return -EINVAL;
+            }
+
+            status = copy_from_user(&obj_handle, (struct obj_handle *) arg, sizeof(obj_handle));
+            if (status) {
+                return -EINVAL;
+            }
+
+            if (obj_handle.priority <= 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_UPDATE@%d>: "
+                    "Invalid argument, priority must be a positive integer!\n", 
+                    current->pid
+                );
+                return -EINVAL;
+            }
+
+            pos = find_handle(queue_list->queue, obj_handle.handle);
+            if (pos < 0) {
+                /* The item left the queue, or never was in it */
+                return pos;
+            }
+            return change_prio(queue_list->queue, pos, obj_handle.priority);
+
+        /* Remove the item of a handle */
+        case PB2_DELETE: ;
+
+            if (queue_list->queue == NULL || queue_list->queue->index == NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_DELETE@%d>: No "
+                    "indexed queue for current process!\n", current->pid
+                );
+                return -EINVAL;
+            }
+
+            status = copy_from_user(&obj_handle, (struct obj_handle *) arg, sizeof(obj_handle));
+            if (status) {
+                return -EINVAL;
+            }
+
+            pos = find_handle(queue_list->queue, obj_handle.handle);
+            if (pos < 0) {
+                return pos;
+            }
+
+            obj_handle.value    = queue_list->queue->items[pos].value;
+            obj_handle.priority = queue_list->queue->items[pos].priority;
+            status = copy_to_user((struct obj_handle *) arg, &obj_handle, sizeof(obj_handle));
+            if (status) {
+                /* The item stays queued */
+                return -EINVAL;
+            }
+            return remove_item(queue_list->queue, pos);
+
+        /* Let the items carry payloads */
+        case PB2_SET_PAYLOAD: ;
 
             if (queue_list->queue == NULL) {
                 /* Queue is not initialized for this process */
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_INFO@%d>: No "
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_SET_PAYLOAD@%d>: No "
                     "queue allocated for current process!\n", current->pid
                 );
                 return -EACCES;
             }
 
-            struct obj_info obj_info;
-            obj_info.prio_que_size = queue_list->queue->count;
-            obj_info.capacity      = queue_list->queue->capacity;
-
-            status = copy_to_user(
-                (struct obj_info *) arg, &obj_info, sizeof(struct obj_info)
-            );
+            struct obj_payload_setup payload_setup;
+            status = copy_from_user(&payload_setup, (struct obj_payload_setup *) arg, 
+                sizeof(payload_setup));
             if (status) {
                 return -EINVAL;
             }
-            break;
-        
-        /* Get minimum priority item */
-        case PB2_GET_MIN:
+
+            return set_payload(queue_list->queue, payload_setup.size);
+
+        /* Insert an item with its payload */
+        case PB2_INSERT_PAYLOAD:
+
+            if (queue_list->queue == NULL || queue_list->queue->arena == NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_PAYLOAD@%d>: No "
+                    "queue carrying payloads for current process!\n", current->pid
+                );
+                return -EINVAL;
+            }
+
+            return push_payload(queue_list->queue, (struct obj_payload *) arg);
+
+        /* Extract the minimum or maximum priority item with its payload */
+        case PB2_GET_MIN_PAYLOAD:
+        case PB2_GET_MAX_PAYLOAD:
+
+            if (queue_list->queue == NULL || queue_list->queue->arena == NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_PAYLOAD@%d>: No "
+                    "queue carrying payloads for current process!\n", current->pid
+                );
+                return -EINVAL;
+            }
+
+            if (cmd == PB2_GET_MAX_PAYLOAD && !tracks_max(queue_list->queue)) {
+                return -EINVAL;
+            }
+
+            status = wait_for_items(file, queue_list);
+            if (status) {
+                return status;
+            }
+
+            return pop_payload(queue_list->queue, cmd == PB2_GET_MAX_PAYLOAD, 
+                (struct obj_payload *) arg);
+
+        /* Insert an item that only becomes extractable at its due time */
+        case PB2_INSERT_DELAYED: ;
 
             if (queue_list->queue == NULL) {
                 /* Queue is not initialized for this process */
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_MIN@%d>: No "
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_DELAYED@%d>: No "
                     "queue allocated for current process!\n", current->pid
                 );
                 return -EACCES;
             }
 
-            if (queue_list->queue->count == 0) {
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_MIN@%d>: No item "
-                    "present in priority queue!\n", current->pid
+            struct obj_delayed obj_delayed;
+            status = copy_from_user(&obj_delayed, (struct obj_delayed *) arg, 
+                sizeof(obj_delayed));
+            if (status) {
+                return -EINVAL;
+            }
+
+            if (obj_delayed.priority <= 0) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_INSERT_DELAYED@%d>: "
+                    "Invalid argument, priority must be a positive integer!\n", 
+                    current->pid
+                );
+                return -EINVAL;
+            }
+
+            return push_delayed(queue_list->queue, (struct item_t) {
+                .value    = obj_delayed.value,
+                .priority = obj_delayed.priority,
+            }, obj_delayed.not_before);
+
+        /* Signal eventfds when the count crosses watermarks */
+        case PB2_SET_NOTIFY: ;
+
+            if (queue_list->queue == NULL) {
+                /* Queue is not initialized for this process */
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_SET_NOTIFY@%d>: No "
+                    "queue allocated for current process!\n", current->pid
                 );
                 return -EACCES;
             }
 
-            item_value = extract_min(queue_list->queue);
-            status = copy_to_user((int32_t *) arg, &item_value, sizeof(int32_t));
+            struct obj_notify obj_notify;
+            status = copy_from_user(&obj_notify, (struct obj_notify *) arg, sizeof(obj_notify));
             if (status) {
                 return -EINVAL;
             }
 
-            break;
+            return set_notify(queue_list, &obj_notify);
 
-        /* Get maximum priority item */
-        case PB2_GET_MAX:
+        /* Save the items as a binary blob, or load one into the empty queue */
+        case PB2_SNAPSHOT_SAVE:
+        case PB2_SNAPSHOT_LOAD: ;
 
             if (queue_list->queue == NULL) {
                 /* Queue is not initialized for this process */
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_MAX@%d>: No "
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_SNAPSHOT@%d>: No "
                     "queue allocated for current process!\n", current->pid
                 );
                 return -EACCES;
             }
 
-            if (queue_list->queue->count == 0) {
-                printk(
-                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_GET_MAX@%d>: No item "
-                    "present in priority queue!\n", current->pid
-                );
-                return -EACCES;
+            struct obj_snapshot snapshot;
+            status = copy_from_user(&snapshot, (struct obj_snapshot *) arg, sizeof(snapshot));
+            if (status) {
+                return -EINVAL;
             }
 
-            item_value = extract_max(queue_list->queue);
-            status = copy_to_user((int32_t *) arg, &item_value, sizeof(int32_t));
+            if (cmd == PB2_SNAPSHOT_LOAD) {
+                /* Fill the empty queue from a blob in one copy */
+                return load_snapshot(queue_list->queue, &snapshot);
+            }
+
+            status = save_snapshot(queue_list->queue, &snapshot);
             if (status) {
+                return status;
+            }
+            if (copy_to_user((struct obj_snapshot *) arg, &snapshot, sizeof(snapshot))) {
                 return -EINVAL;
             }
             break;
 
+        /* Keep a named queue for adoption after its last release */
+        case PB2_SET_RETAIN: ;
+
+            struct obj_retain obj_retain;
+            status = copy_from_user(&obj_retain, (struct obj_retain *) arg, sizeof(obj_retain));
+            if (status) {
+                return -EINVAL;
+            }
+
+            return set_retain(queue_list, obj_retain.seconds);
+
+        /* Doorbell: process all pending submissions */
+        case PB2_RING_ENTER:
+
+            if (queue_file->ring == NULL) {
+                debug_printk(
+                    KERN_ALERT DEVICE_NAME " <qioctl::PB2_RING_ENTER@%d>: No "
+                    "rings set up for current process!\n", current->pid
+                );
+                return -EACCES;
+            }
+
+            return process_ring(queue_file, queue_list);
+
         default:
             /* Invalid command */
             return -EINVAL;
@@ -1018,6 +4897,79 @@ static long qioctl(struct file *file, unsigned int cmd, unsigned long arg) {
 }
 
 
+/**
+ * @brief Map the shared submission and completion rings into userspace
+ * 
+ * @return 0 (if successful)
+ *         -EACCES
+ *             - when no rings are set up for current process
+ *         -EINVAL
+ *             - when the mapping is larger than the rings
+ */
+static int qmmap(struct file *file, struct vm_area_struct *vma) {
+    struct queue_file *queue_file = file->private_data;
+
+    /**
+     * The queue lock is not taken here: mmap runs under the mm's lock, which
+     * ioctls holding the queue lock may need to fault on user memory. The
+     * rings are published once by `setup_ring` and live until release.
+     */
+    struct obj_ring *ring = smp_load_acquire(&queue_file->ring);
+    if (ring == NULL) {
+        debug_printk(
+            KERN_ALERT DEVICE_NAME " <mmap@%d>: No rings set up for current "
+            "process!\n", current->pid
+        );
+        return -EACCES;
+    }
+
+    /* The mapping holds a reference to the file, so the rings outlive it */
+    return remap_vmalloc_range(vma, ring, vma->vm_pgoff);
+}
+
+
+/**
+ * @brief Report readiness of the queue for `poll`/`epoll`
+ * 
+ * @return EPOLLIN when an item can be extracted and EPOLLOUT when an item can
+ *         be inserted
+ */
+static __poll_t qpoll(struct file *file, struct poll_table_struct *wait) {
+    struct queue_file *queue_file = file->private_data;
+    struct queue_list *queue_list = READ_ONCE(queue_file->queue_list);
+    __poll_t mask = 0;
+
+    poll_wait(file, &queue_list->wait, wait);
+
+    struct relaxed_queue *relaxed = lock_queue_list(queue_list);
+    if (relaxed != NULL) {
+        int count = atomic_read(&relaxed->count);
+        if (count > 0) {
+            mask |= EPOLLIN | EPOLLRDNORM;
+        }
+        if (count < relaxed->capacity) {
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        }
+        return mask;
+    }
+
+    if (queue_list->queue != NULL) {
+        if (release_due(queue_list->queue) > 0) {
+            queue_changed(queue_list);
+        }
+        if (queue_list->queue->count > 0) {
+            mask |= EPOLLIN | EPOLLRDNORM;
+        }
+        if (held_items(queue_list->queue) < queue_list->queue->capacity) {
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        }
+    }
+    mutex_unlock(&queue_list->lock);
+
+    return mask;
+}
+
+
 /**
  * @brief Initiating module
  * 
@@ -1026,13 +4978,41 @@ static long qioctl(struct file *file, unsigned int cmd, unsigned long arg) {
  *             -unable to create proc_entry
  */
 static int _module_init(void) {
+    if (create_caches()) {
+        destroy_caches();
+        return -ENOMEM;
+    }
+
+#if defined(CONFIG_X86_64) && defined(HEAP_SIMD)
+    simd = simd && boot_cpu_has(X86_FEATURE_AVX2) &&
+        cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL);
+    if (simd) {
+        static_branch_enable(&simd_key);
+    }
+#else
+    simd = false;
+#endif
+
+    /* Statistics are optional, debugfs may well be unavailable */
+    debugfs_dir = debugfs_create_dir("pqkmod", NULL);
+    debugfs_create_file("queues", 0444, debugfs_dir, NULL, &queue_table_fops);
+
+    pqkmod_wq = alloc_workqueue("pqkmod", 0, 0);
+    if (pqkmod_wq == NULL) {
+        debugfs_remove_recursive(debugfs_dir);
+        destroy_caches();
+        return -ENOMEM;
+    }
+
     /* Create proc directory for the module */
     struct proc_dir_entry *entry = proc_create(DEVICE_NAME, PERMS, NULL, &proc_ops);
     if (entry == NULL) {
+        destroy_workqueue(pqkmod_wq);
+        debugfs_remove_recursive(debugfs_dir);
+        destroy_caches();
         return -ENOENT;
     }
 
-    init_list();         /* Create header for linked list of `queue_list` */
     mutex_init(&qlock); 
     printk(KERN_INFO DEVICE_NAME " Module initiation completed.\n");
     return 0;
@@ -1043,8 +5023,12 @@ static int _module_init(void) {
  * @brief Exiting module
  */
 static void _module_exit(void) {
+    /* Removing the entry releases files that are still open */
+    remove_proc_entry(DEVICE_NAME, NULL);
     free_list();
+    destroy_workqueue(pqkmod_wq);
+    debugfs_remove_recursive(debugfs_dir);
+    destroy_caches();
     mutex_destroy(&qlock);
-    remove_proc_entry(DEVICE_NAME, NULL);
     printk(KERN_INFO DEVICE_NAME " exiting module.\n");
 }
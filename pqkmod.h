@@ -0,0 +1,368 @@
+/**
+ * CS60038 - Advances in Operating Systems Design
+ * Assignment 1 (Part B) and Assigment 2
+ *
+ * Interface of the priority-queue module, shared by the kernel module and the
+ * userspace clients
+ *
+ * Author: Utkarsh Patel (18EC35034)
+ */
+
+#ifndef PQKMOD_H
+#define PQKMOD_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+#define PERMS 0666                         /* all users can read and write */
+#define DEVICE_NAME "cs60038_a2_17"
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT   _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO  _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_INFO     _IOW(0x10, 0x34, int32_t *)
+#define PB2_GET_MIN      _IOW(0x10, 0x35, int32_t *)
+#define PB2_GET_MAX      _IOW(0x10, 0x36, int32_t *)
+#define PB2_PEEK_MIN     _IOW(0x10, 0x37, int32_t *)
+#define PB2_PEEK_MAX     _IOW(0x10, 0x38, int32_t *)
+#define PB2_INSERT_BATCH _IOW(0x10, 0x39, int32_t *)
+#define PB2_EXTRACT_MIN_N _IOW(0x10, 0x3a, int32_t *)
+#define PB2_EXTRACT_MAX_N _IOW(0x10, 0x3b, int32_t *)
+#define PB2_RING_SETUP   _IOW(0x10, 0x3c, int32_t *)
+#define PB2_RING_ENTER   _IOW(0x10, 0x3d, int32_t *)
+#define PB2_ATTACH       _IOW(0x10, 0x3e, int32_t *)
+#define PB2_SET_RELAXED  _IOW(0x10, 0x3f, int32_t *)
+#define PB2_SET_INDEXED  _IOW(0x10, 0x40, int32_t *)
+#define PB2_INSERT_HANDLE _IOW(0x10, 0x41, int32_t *)
+#define PB2_UPDATE       _IOW(0x10, 0x42, int32_t *)
+#define PB2_DELETE       _IOW(0x10, 0x43, int32_t *)
+#define PB2_CREATE       _IOW(0x10, 0x44, int32_t *)
+#define PB2_SET_PAYLOAD  _IOW(0x10, 0x45, int32_t *)
+#define PB2_INSERT_PAYLOAD _IOW(0x10, 0x46, int32_t *)
+#define PB2_GET_MIN_PAYLOAD _IOW(0x10, 0x47, int32_t *)
+#define PB2_GET_MAX_PAYLOAD _IOW(0x10, 0x48, int32_t *)
+#define PB2_SET_NOTIFY   _IOW(0x10, 0x49, int32_t *)
+#define PB2_INSERT_DELAYED _IOW(0x10, 0x4a, int32_t *)
+#define PB2_SNAPSHOT_SAVE _IOW(0x10, 0x4b, int32_t *)
+#define PB2_SNAPSHOT_LOAD _IOW(0x10, 0x4c, int32_t *)
+#define PB2_SET_RETAIN   _IOW(0x10, 0x4d, int32_t *)
+
+#define PB2_NAME_LEN     32        /* maximum length of a queue name, with NUL */
+
+struct obj_info {
+	int32_t prio_que_size; 	/* current number of elements in priority-queue */
+	int32_t capacity;		/* maximum capacity of priority-queue */
+};
+
+struct obj_item {
+	int32_t value;			/* item value */
+	int32_t priority;		/* item priority */
+};
+
+struct obj_batch {
+	int32_t count;			/* number of items in `items` */
+	int32_t done;			/* set by the module: number of items processed */
+	uint64_t items;			/* userspace address of `struct obj_item[count]` */
+};
+
+/**
+ * Named queues
+ * 
+ * Every open file starts with its own anonymous queue. PB2_ATTACH attaches
+ * the file to the queue of given name: if no such queue exists, the file's
+ * queue gets that name (and keeps its items), otherwise the file joins the
+ * existing queue, which is then shared with every other attached file. A
+ * file can be attached only once, and before it sets up rings or caches an
+ * item value (PB2_INSERT_INT or a 4-byte write), or PB2_ATTACH fails with
+ * EBUSY. A queue lives until the last file attached to it is closed.
+ */
+struct obj_attach {
+	char name[PB2_NAME_LEN];	/* NUL-terminated, non-empty */
+};
+
+/**
+ * Relaxed mode
+ * 
+ * PB2_SET_RELAXED splits an initialized queue into `shards` heaps (one per
+ * online CPU when `shards` is 0, at most one per item of capacity), splits
+ * the capacity of the original queue evenly among them and moves its items
+ * over. A shard may thus be full while others still have room. Inserts go to the shard of the current
+ * CPU; extracts sample `choices` shards at random and pop from the one with
+ * the best top item. Fewer choices and more shards scale better, while
+ * `choices` >= `shards` always picks the best top of all shards. Extracted
+ * items are then only approximately in priority order.
+ * 
+ * A relaxed queue stays relaxed until released. It supports whole-record
+ * reads and writes, 4-byte reads, PB2_GET_INFO, PB2_GET_MIN, PB2_GET_MAX,
+ * PB2_INSERT_BATCH, PB2_EXTRACT_MIN_N, PB2_EXTRACT_MAX_N and PB2_SET_RETAIN;
+ * other commands fail with EINVAL (EBUSY for PB2_SET_CAPACITY,
+ * PB2_SET_RELAXED, PB2_SET_INDEXED, PB2_CREATE, PB2_SET_PAYLOAD and
+ * PB2_SET_NOTIFY). As in strict mode, a bad priority rejects a whole batch.
+ * A batch extract that faults after delivering items reports them in `done`
+ * instead of failing.
+ */
+struct obj_relaxed {
+	int32_t shards;			/* number of heaps, 0 for one per online CPU */
+	int32_t choices;		/* shards sampled per extract, at least 1 */
+};
+
+/**
+ * Handles
+ * 
+ * PB2_SET_INDEXED makes an empty, strict queue track its items by handle.
+ * PB2_INSERT_HANDLE then inserts an item like PB2_INSERT_PRIO and reports
+ * its handle, which stays valid until the item leaves the queue, however it
+ * leaves. PB2_UPDATE changes the priority of the item of a handle, up or
+ * down, and PB2_DELETE removes it and reports its value and priority. Both
+ * fail with EINVAL when the item is no longer queued.
+ * 
+ * With `upsert`, a queue holds at most one item per value: inserting a
+ * value that is already queued (by any command) only changes the priority
+ * of the queued item, and PB2_INSERT_HANDLE reports that item's handle.
+ * 
+ * Indexing lasts until the queue is released. It fails with EBUSY on a queue
+ * that holds items, is already indexed, carries payloads or is relaxed, and
+ * PB2_SET_RELAXED fails with EBUSY on an indexed queue.
+ */
+struct obj_indexed {
+	int32_t upsert;			/* non-zero to merge items of equal value */
+};
+
+struct obj_handle {
+	int32_t handle;			/* set by PB2_INSERT_HANDLE, given otherwise */
+	int32_t value;			/* item value (set by PB2_DELETE) */
+	int32_t priority;		/* item priority (set by PB2_DELETE) */
+};
+
+/**
+ * Engines
+ * 
+ * PB2_CREATE initializes the queue like PB2_SET_CAPACITY (which it fails
+ * with EBUSY after), choosing how the queue keeps its items:
+ *     PB2_ENGINE_HEAP   min-max heap, what PB2_SET_CAPACITY creates
+ *     PB2_ENGINE_RADIX  radix heap, for queues whose extracted minimums never
+ *                       decrease, such as timers and shortest-path searches;
+ *                       inserts take O(1) and extracts amortized O(log C) for
+ *                       priorities up to C
+ *     PB2_ENGINE_BUCKET one FIFO bucket per priority in 1 .. `range` (at most
+ *                       PB2_BUCKET_MAX_RANGE), such as QoS classes; every
+ *                       operation takes O(1), and items of equal priority
+ *                       come out in insertion order
+ * Inserting a priority lower than the last one extracted from a radix queue
+ * fails with EINVAL, as do PB2_GET_MAX, PB2_PEEK_MAX, PB2_EXTRACT_MAX_N and
+ * PB2_OP_EXTRACT_MAX. Inserting a priority beyond the range of a bucket queue
+ * fails with EINVAL. Only heaps can be relaxed or indexed (EBUSY otherwise).
+ */
+#define PB2_ENGINE_HEAP   0
+#define PB2_ENGINE_RADIX  1
+#define PB2_ENGINE_BUCKET 2
+
+#define PB2_BUCKET_MAX_RANGE 4096
+
+struct obj_create {
+	int32_t capacity;		/* maximum number of items */
+	int32_t engine;			/* one of PB2_ENGINE_* */
+	int32_t range;			/* highest priority, for PB2_ENGINE_BUCKET */
+};
+
+/**
+ * Payloads
+ * 
+ * PB2_SET_PAYLOAD lets every item of an empty, strict queue carry up to
+ * `size` bytes of data (at most PB2_MAX_PAYLOAD), kept by the module next to
+ * the item's value and priority. PB2_INSERT_PAYLOAD inserts the record at
+ * `arg`, a `struct obj_payload` followed by its `size` bytes of data, and
+ * PB2_GET_MIN_PAYLOAD (PB2_GET_MAX_PAYLOAD) extracts the minimum (maximum)
+ * priority item into the buffer at `arg`, which must have room for a
+ * `struct obj_payload` and the queue's `size` bytes: the whole record is
+ * written in one copy. Both extracts wait for an item like PB2_GET_MIN.
+ * 
+ * Payloads last until the queue is released. Setting them fails with EBUSY
+ * on a queue that holds items, already carries payloads, is indexed or is
+ * relaxed, and PB2_SET_RELAXED and PB2_SET_INDEXED fail with EBUSY on a
+ * queue carrying payloads. Such a queue supports PB2_SET_CAPACITY,
+ * PB2_GET_INFO, PB2_PEEK_MIN, PB2_PEEK_MAX, PB2_SET_NOTIFY, PB2_SET_RETAIN
+ * and the payload commands; reads, writes and other commands fail with
+ * EINVAL.
+ */
+#define PB2_MAX_PAYLOAD  4096
+
+struct obj_payload_setup {
+	int32_t size;			/* maximum bytes of data per item */
+};
+
+struct obj_payload {
+	int32_t value;			/* item value */
+	int32_t priority;		/* item priority */
+	int32_t size;			/* bytes in `data` */
+	uint8_t data[];			/* payload */
+};
+
+/**
+ * Watermark notifications
+ * 
+ * PB2_SET_NOTIFY registers eventfds that the module signals when the number
+ * of items in the queue crosses a threshold:
+ *     `nonempty_fd` when it rises from 0
+ *     `high_fd`     when it rises above `high`
+ *     `low_fd`      when it falls below `low`
+ * Each event fires once per crossing, whatever the command or the attached
+ * file that caused it; registering does not fire for the current count, so
+ * event loops should check PB2_GET_INFO afterwards. A negative fd leaves the
+ * event out. Registrations belong to the queue, shared by every attached
+ * file, and each one replaces the previous one: all fds negative turns
+ * notifications off.
+ * 
+ * It fails with EBADF or EINVAL for an fd that is not an eventfd, EINVAL for
+ * a negative `high` or a `low` below 1 (when their fds are given), and EBUSY
+ * on a relaxed queue, whose registration is fixed when it is split.
+ */
+struct obj_notify {
+	int32_t nonempty_fd;		/* eventfd signaled when the queue fills from empty */
+	int32_t high_fd;		/* eventfd signaled when the count exceeds `high` */
+	int32_t low_fd;			/* eventfd signaled when the count drops below `low` */
+	int32_t high;			/* high watermark */
+	int32_t low;			/* low watermark */
+};
+
+/**
+ * Delayed items
+ * 
+ * PB2_INSERT_DELAYED inserts an item that cannot be extracted before
+ * `not_before`, a CLOCK_MONOTONIC time in nanoseconds (see clock_gettime).
+ * The module holds it until then, and moves it into the queue on time
+ * together with every other item due by then, waking blocked readers and
+ * pollers. An item already due is inserted at once. Held items count
+ * against the capacity, but not in the size reported by PB2_GET_INFO.
+ * 
+ * It fails like PB2_INSERT_PRIO, and with EINVAL on relaxed queues, radix
+ * queues (whose extracted minimum could pass the item's priority before it
+ * is due) and queues carrying payloads. PB2_SET_RELAXED fails with EBUSY on
+ * a queue that took delayed items.
+ */
+struct obj_delayed {
+	int32_t value;			/* item value */
+	int32_t priority;		/* item priority */
+	uint64_t not_before;		/* due time, CLOCK_MONOTONIC nanoseconds */
+};
+
+/**
+ * Snapshots
+ * 
+ * PB2_SNAPSHOT_SAVE writes the items of an initialized queue to `buf` as a
+ * binary blob: a `struct obj_snapshot_header` followed by `count` items
+ * (`struct obj_item`) in the engine's internal order, oldest first within
+ * each priority for bucket queues. It always sets `size` to the size of the
+ * blob; with a NULL `buf` it only does that, and it fails with EINVAL when
+ * `size` is too small.
+ * 
+ * PB2_SNAPSHOT_LOAD fills an initialized, empty queue from a blob of `size`
+ * bytes in one copy. A min-max heap saved by a module of the same heap arity
+ * into a queue of the same engine is taken as it is, after an O(n) check of
+ * its order, or without that check with PB2_SNAPSHOT_TRUST; an out-of-order
+ * blob is reordered. Priorities are checked in either case. Other blobs are inserted into the queue's own engine,
+ * also in O(n) but for indexed queues, which hand out new handles. Loading
+ * fails with EINVAL for a malformed blob or a priority the queue does not
+ * take, EBUSY when the queue is not empty and EACCES when its capacity is
+ * below `count`.
+ * 
+ * Neither works on relaxed queues or queues carrying payloads (EINVAL), and
+ * snapshots leave out items held by PB2_INSERT_DELAYED.
+ * 
+ * PB2_SET_RETAIN keeps a named queue around for `seconds` (at most
+ * PB2_MAX_RETAIN) once its last file is released, so that a restarted
+ * process can adopt it, items and settings included, with PB2_ATTACH. The
+ * queue is deleted when no file attached to it by then; 0 turns retention
+ * off. It fails with EINVAL on anonymous queues.
+ */
+#define PB2_SNAPSHOT_MAGIC   0x534b5150    /* "PQKS" */
+#define PB2_SNAPSHOT_VERSION 1
+#define PB2_SNAPSHOT_TRUST   1             /* skip checking the heap order */
+
+#define PB2_MAX_RETAIN       3600
+
+struct obj_snapshot_header {
+	uint32_t magic;			/* PB2_SNAPSHOT_MAGIC */
+	uint32_t version;		/* PB2_SNAPSHOT_VERSION */
+	int32_t engine;			/* PB2_ENGINE_* of the saved queue */
+	int32_t arity;			/* heap arity of the module that saved it */
+	int32_t range;			/* highest priority, for PB2_ENGINE_BUCKET */
+	int32_t capacity;		/* capacity of the saved queue */
+	int32_t count;			/* number of items that follow */
+	int32_t reserved;		/* 0 */
+};
+
+struct obj_snapshot {
+	uint64_t buf;			/* userspace address of the blob */
+	int32_t size;			/* bytes at `buf` (set by PB2_SNAPSHOT_SAVE) */
+	int32_t flags;			/* PB2_SNAPSHOT_TRUST, for PB2_SNAPSHOT_LOAD */
+};
+
+struct obj_retain {
+	int32_t seconds;		/* grace period after the last release */
+};
+
+/**
+ * Shared-memory rings
+ * 
+ * PB2_RING_SETUP allocates a submission ring and a completion ring for the
+ * queue, each of `entries` slots (a power of two), and reports the number of
+ * bytes to mmap at offset 0 of the proc file. The mapping starts with
+ * `struct obj_ring`, the submission entries start at `sq_off` and the
+ * completion entries at `cq_off`.
+ * 
+ * Userspace fills `obj_sqe` slots at `sq_tail` and publishes them by storing
+ * `sq_tail` with release semantics. PB2_RING_ENTER (the doorbell) makes the
+ * module process every published submission, in order, and post one
+ * `obj_cqe` per submission at `cq_tail`; it returns the number of
+ * submissions consumed. Processing stops early when the completion ring is
+ * full, so userspace should consume completions by advancing `cq_head` (a
+ * release store) before ringing again. Head and tail are free-running
+ * counters; slot `i` lives at index `i & (entries - 1)`. The module keeps
+ * its own `sq_head` and `cq_tail`, and overwrites whatever userspace stores
+ * there.
+ */
+#define PB2_OP_INSERT      1       /* push (value, priority) */
+#define PB2_OP_EXTRACT_MIN 2       /* pop minimum priority item */
+#define PB2_OP_EXTRACT_MAX 3       /* pop maximum priority item */
+
+struct obj_ring_setup {
+	int32_t entries;		/* number of slots in each ring */
+	int32_t size;			/* set by the module: bytes to mmap */
+};
+
+struct obj_ring {
+	uint32_t sq_head;		/* written by the module */
+	uint32_t pad0[15];
+	uint32_t sq_tail;		/* written by userspace */
+	uint32_t pad1[15];
+	uint32_t cq_head;		/* written by userspace */
+	uint32_t pad2[15];
+	uint32_t cq_tail;		/* written by the module */
+	uint32_t pad3[15];
+	uint32_t entries;		/* number of slots in each ring */
+	uint32_t sq_off;		/* offset of `struct obj_sqe[entries]` */
+	uint32_t cq_off;		/* offset of `struct obj_cqe[entries]` */
+	uint32_t pad4[13];
+};
+
+struct obj_sqe {
+	int32_t opcode;			/* one of PB2_OP_* */
+	int32_t value;			/* item value (PB2_OP_INSERT) */
+	int32_t priority;		/* item priority (PB2_OP_INSERT) */
+	uint32_t user_data;		/* copied to the completion */
+};
+
+struct obj_cqe {
+	int32_t result;			/* 0 or a negative error code */
+	int32_t value;			/* extracted item value */
+	int32_t priority;		/* extracted item priority */
+	uint32_t user_data;		/* from the submission */
+};
+
+#endif /* PQKMOD_H */
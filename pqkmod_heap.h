@@ -0,0 +1,583 @@
+/**
+ * CS60038 - Advances in Operating Systems Design
+ * Assignment 1 (Part B) and Assigment 2
+ *
+ * Min-max heap engine of the priority-queue module. It only works on an array
+ * of items and its length, leaving allocation, locking, statistics and
+ * tracing to the caller, so that the same code is compiled into the kernel
+ * module and into the userspace heap benchmark (heap_bench.c).
+ *
+ * Author: Utkarsh Patel (18EC35034)
+ */
+
+#ifndef PQKMOD_HEAP_H
+#define PQKMOD_HEAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/**
+ * Wrapper for element in the priority queue
+ */
+struct item_t {
+    int32_t value, priority;
+};
+
+/**
+ * Items are kept in a d-ary min-max heap: nodes on even levels (the root is on
+ * level 0) hold the minimum of their subtree and nodes on odd levels hold the
+ * maximum. Hence both the minimum and the maximum priority items can be read
+ * in O(1) and extracted in O(log n).
+ * 
+ * The children of node `i` are `CHILD(i) .. CHILD(i) + HEAP_ARITY - 1` and its
+ * grandchildren the `HEAP_ARITY^2` nodes from `CHILD(CHILD(i))` on, all
+ * contiguous. Item arrays are allocated so that `items[1]` starts a cache
+ * line (see `HEAP_PAD`), hence with 4 children per node (-DHEAP_ARITY=4) a
+ * node's children share half a line and its grandchildren span three lines,
+ * and with 8 children one and eight lines. Wider heaps are shallower and take
+ * fewer cache misses per operation, but each step down a min-max heap scans
+ * all grandchildren: with random priorities 4-ary heaps push about 25%
+ * faster than binary ones at 10^5 to 10^7 items and pop at the same speed,
+ * so the default stays binary.
+ * 
+ * Sifting carries the moving item in a local variable and shifts the items on
+ * its path into the hole it leaves, writing it once at its final place.
+ */
+#ifndef HEAP_ARITY
+#define HEAP_ARITY 2
+#endif
+
+#if HEAP_ARITY != 2 && HEAP_ARITY != 4 && HEAP_ARITY != 8
+#error "HEAP_ARITY must be 2, 4 or 8"
+#endif
+
+#define HEAP_SHIFT (HEAP_ARITY == 2 ? 1 : HEAP_ARITY == 4 ? 2 : 3)
+
+#define CHILD(x)  ((x) * HEAP_ARITY + 1)
+#define PARENT(x) (((x) - 1) / HEAP_ARITY)
+
+/* Level `l` starts at index (d^l - 1) / (d - 1), hence i * (d - 1) + 1 lies in
+   [d^l, d^(l + 1)) */
+#define HEAP_LEVEL(x) \
+    ((63 - __builtin_clzll((unsigned long long) (x) * (HEAP_ARITY - 1) + 1)) / HEAP_SHIFT)
+#define IS_MIN_LEVEL(x) ((HEAP_LEVEL(x) & 1) == 0)
+
+/* Items to allocate before a cache-aligned array's `items[1]` to align it */
+#define HEAP_LINE_ITEMS (64 / sizeof(struct item_t))
+#define HEAP_PAD        (HEAP_LINE_ITEMS - 1)
+
+/**
+ * SIMD child selection
+ * 
+ * On x86-64 wide heaps (4 or 8 children per node) look for the extreme of a
+ * full block of 16 or 64 grandchildren with AVX2, 8 priorities at a time:
+ * the priorities of 8 interleaved items are gathered into one register by a
+ * single shuffle, so the items array keeps its layout. The includer decides
+ * at run time whether AVX2 may be used by defining `heap_simd_enabled()`,
+ * and how to claim the vector registers around a sift with
+ * `heap_simd_begin()` and `heap_simd_end()` (kernel_fpu_begin/end in the
+ * module). Heaps of less than `HEAP_SIMD_MIN` items, where claiming the
+ * registers costs more than it saves, and other architectures use the
+ * scalar loop. With it, 4-ary and 8-ary heaps of 10^5 items and more pop
+ * 25-35% faster than binary ones.
+ */
+#if defined(__x86_64__) && HEAP_ARITY >= 4
+#define HEAP_SIMD
+#endif
+
+#ifndef heap_simd_enabled
+#define heap_simd_enabled() 0
+#endif
+#ifndef heap_simd_begin
+#define heap_simd_begin()   do { } while (0)
+#define heap_simd_end()     do { } while (0)
+#endif
+
+#define HEAP_SIMD_MIN       1024
+
+/* Vector registers are the compiler's own in userspace, not in the kernel */
+#ifdef __SSE__
+#define HEAP_SIMD_CLOBBERS  , "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", \
+    "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+#else
+#define HEAP_SIMD_CLOBBERS
+#endif
+
+
+/**
+ * @brief Swap two items in priority queue
+ *
+ * @param item1: Pointer to first item
+ * @param item2: Pointer to second item
+ */
+static inline void swap_items(struct item_t *item1, struct item_t *item2) {
+    struct item_t tmp = *item1;
+    *item1            = *item2;
+    *item2            = tmp;
+}
+
+/**
+ * @brief Compare two items in the priority queue
+ *
+ * @param item1: First item
+ * @param item2: Second item
+ *
+ * @returns  0, when item1 == item2
+ *           1, when item1  > item2
+ *          -1, when item1  < item2
+ */
+static inline int compare_items(struct item_t item1, struct item_t item2) {
+    return (item1.priority > item2.priority) ? 1 :
+        (item1.priority < item2.priority) ? -1 : 0;
+}
+
+/**
+ * @brief Whether priority `a` must be above priority `b` on a level of given
+ * kind. `dir` is a constant wherever this is inlined, so it costs a single
+ * comparison.
+ *
+ * @param dir: -1 for min levels, +1 for max levels
+ */
+static inline int precedes(int32_t a, int32_t b, int dir) {
+    return dir < 0 ? a < b : a > b;
+}
+
+#ifdef HEAP_SIMD
+/**
+ * @brief Find the extreme priority of `n` items (a multiple of 8) with AVX2
+ * 
+ * The first pass folds the priorities into 8 running extremes with `op`
+ * (vpminsd or vpmaxsd) and reduces them to one, the second pass looks for
+ * the first group of 8 items holding it. `vshufps` packs the priorities of
+ * items 0, 1, 4, 5, 2, 3, 6, 7 of a group, in that order.
+ */
+#define HEAP_SIMD_EXTREME(name, op)                                             \
+static inline size_t name(const struct item_t *items, size_t n, int32_t *best) { \
+    static const unsigned char lanes[8] = { 0, 1, 4, 5, 2, 3, 6, 7 };          \
+    size_t offset;                                                              \
+    unsigned int mask;                                                          \
+    int32_t value;                                                              \
+                                                                                \
+    asm volatile(                                                               \
+        "vmovdqu (%[items]), %%ymm0\n\t"                                         \
+        "vshufps $0xdd, 32(%[items]), %%ymm0, %%ymm0\n\t"                        \
+        "mov $64, %[offset]\n\t"                                                \
+        "1: cmp %[bytes], %[offset]\n\t"                                        \
+        "jae 2f\n\t"                                                            \
+        "vmovdqu (%[items], %[offset]), %%ymm1\n\t"                              \
+        "vshufps $0xdd, 32(%[items], %[offset]), %%ymm1, %%ymm1\n\t"             \
+        op " %%ymm1, %%ymm0, %%ymm0\n\t"                                         \
+        "add $64, %[offset]\n\t"                                                \
+        "jmp 1b\n\t"                                                            \
+        "2: vextracti128 $1, %%ymm0, %%xmm1\n\t"                                \
+        op " %%xmm1, %%xmm0, %%xmm0\n\t"                                         \
+        "vpshufd $0x4e, %%xmm0, %%xmm1\n\t"                                     \
+        op " %%xmm1, %%xmm0, %%xmm0\n\t"                                         \
+        "vpshufd $0xb1, %%xmm0, %%xmm1\n\t"                                     \
+        op " %%xmm1, %%xmm0, %%xmm0\n\t"                                         \
+        "vmovd %%xmm0, %[value]\n\t"                                            \
+        "vinserti128 $1, %%xmm0, %%ymm0, %%ymm0\n\t"                             \
+        "xor %[offset], %[offset]\n\t"                                          \
+        "3: vmovdqu (%[items], %[offset]), %%ymm1\n\t"                           \
+        "vshufps $0xdd, 32(%[items], %[offset]), %%ymm1, %%ymm1\n\t"             \
+        "vpcmpeqd %%ymm0, %%ymm1, %%ymm1\n\t"                                    \
+        "vmovmskps %%ymm1, %[mask]\n\t"                                          \
+        "add $64, %[offset]\n\t"                                                \
+        "test %[mask], %[mask]\n\t"                                             \
+        "jz 3b\n\t"                                                             \
+        "vzeroupper\n\t"                                                        \
+        : [offset] "=&r" (offset), [mask] "=&r" (mask), [value] "=&r" (value)  \
+        : [items] "r" (items), [bytes] "r" (n * sizeof(struct item_t))         \
+        : "cc", "memory" HEAP_SIMD_CLOBBERS);                                   \
+                                                                                \
+    *best = value;                                                              \
+    return (offset / 64 - 1) * 8 + lanes[__builtin_ctz(mask)];                  \
+}
+
+HEAP_SIMD_EXTREME(heap_simd_min, "vpminsd")
+HEAP_SIMD_EXTREME(heap_simd_max, "vpmaxsd")
+#endif
+
+/**
+ * Position index
+ * 
+ * Callers that need to find items again after they moved pass a `struct
+ * heap_slots`, or NULL when they do not. Every item then carries a 32-bit
+ * handle, whose low `HEAP_ID_BITS` bits are an id below the array's length:
+ * `slots[i]` is the handle of the item at position `i` and `positions[id]`
+ * the position of the item with that id. The routines below keep both up to
+ * date as they move items; handing out and recycling handles is the
+ * caller's business.
+ */
+#define HEAP_ID_BITS 24
+#define HEAP_ID_MASK ((1U << HEAP_ID_BITS) - 1)
+
+struct heap_slots {
+    uint32_t *slots;               /* handle of the item at each position */
+    uint32_t *positions;           /* position of the item of each id */
+};
+
+/* Store an item and its handle at position `to` */
+static inline __attribute__((always_inline)) void
+heap_put(struct item_t *items, const struct heap_slots *hs, size_t to,
+         struct item_t item, uint32_t handle) {
+    items[to] = item;
+    if (hs) {
+        hs->slots[to] = handle;
+        hs->positions[handle & HEAP_ID_MASK] = to;
+    }
+}
+
+/* Move the item at position `from`, and its handle, to position `to` */
+static inline __attribute__((always_inline)) void
+heap_move(struct item_t *items, const struct heap_slots *hs, size_t to, size_t from) {
+    heap_put(items, hs, to, items[from], hs ? hs->slots[from] : 0);
+}
+
+/* Handle of the item at position `i` */
+static inline uint32_t heap_handle(const struct heap_slots *hs, size_t i) {
+    return hs ? hs->slots[i] : 0;
+}
+
+/**
+ * @brief Index of the maximum priority item. The maximum is the root when it
+ * is the only item, otherwise the largest of the root's children (which are
+ * on the first max level).
+ *
+ * @param items: Array of items
+ * @param count: Number of items in the heap, at least 1
+ */
+static inline size_t heap_max_index(const struct item_t *items, size_t count) {
+    size_t end = count < HEAP_ARITY + 1 ? count : HEAP_ARITY + 1;
+    size_t pos = 0, i;
+
+    for (i = 1; i < end; i++) {
+        if (i == 1 || items[i].priority > items[pos].priority) {
+            pos = i;
+        }
+    }
+    return pos;
+}
+
+/**
+ * @brief Trickle an item down from given index, on a level of kind `dir`
+ *
+ * On a min level the item is compared with the smallest of its children and
+ * grandchildren (on a max level, with the largest). Children that have
+ * children of their own cannot hold that extreme, so only the childless ones
+ * are scanned, and only when the grandchildren are not all there. When the
+ * extreme is a grandchild, it moves up into the hole and the item goes on
+ * from the grandchild's slot, after trading places with the grandchild's
+ * parent (on the opposite kind of level) if out of order.
+ * 
+ * `simd` is a constant wherever this is inlined: non-zero when vector
+ * registers are claimed and a full block of grandchildren is searched with
+ * `heap_simd_min` or `heap_simd_max`. So is `hs` when it is NULL, which
+ * leaves no trace of the position index in that copy.
+ */
+static inline __attribute__((always_inline)) void
+sift_down(struct item_t *items, size_t count, size_t index, struct item_t item,
+          uint32_t handle, int dir, int simd, const struct heap_slots *hs) {
+#ifndef HEAP_SIMD
+    (void) simd;
+#endif
+    while (CHILD(index) < count) {
+        size_t first = CHILD(index);
+        size_t grand = CHILD(first);
+        size_t end   = grand + HEAP_ARITY * HEAP_ARITY;
+        size_t pos, i;
+        int32_t best;
+
+        /* `pos` points to the extreme item among candidates, `best` is its
+           priority; a full block of grandchildren is scanned unconditionally */
+#ifdef HEAP_SIMD
+        if (simd && end <= count) {
+            pos = grand + (dir < 0 ? heap_simd_min : heap_simd_max)
+                (items + grand, HEAP_ARITY * HEAP_ARITY, &best);
+        } else
+#endif
+        if (end <= count) {
+            pos  = grand;
+            best = items[grand].priority;
+            for (i = grand + 1; i < end; i++) {
+                if (precedes(items[i].priority, best, dir)) {
+                    pos  = i;
+                    best = items[i].priority;
+                }
+            }
+        } else {
+            pos  = first;
+            best = items[first].priority;
+            for (i = grand; i < count; i++) {
+                if (precedes(items[i].priority, best, dir)) {
+                    pos  = i;
+                    best = items[i].priority;
+                }
+            }
+            /* Childless children, which come after those with children */
+            for (i = first; i < first + HEAP_ARITY && i < count; i++) {
+                if (CHILD(i) >= count && precedes(items[i].priority, best, dir)) {
+                    pos  = i;
+                    best = items[i].priority;
+                }
+            }
+        }
+
+        if (!precedes(best, item.priority, dir)) {
+            break;
+        }
+        heap_move(items, hs, index, pos);
+        index = pos;
+
+        if (pos < grand) {
+            /* Children are leaves of this subtree's two-level window */
+            break;
+        }
+
+        /* Grandchild: keep the item ordered against its parent on the other
+           level */
+        size_t parent = PARENT(pos);
+        if (precedes(items[parent].priority, item.priority, dir)) {
+            struct item_t tmp = items[parent];
+            uint32_t tmp_handle = heap_handle(hs, parent);
+            heap_put(items, hs, parent, item, handle);
+            item   = tmp;
+            handle = tmp_handle;
+        }
+    }
+    heap_put(items, hs, index, item, handle);
+}
+
+/* `sift_down` for the kind of level of `index` */
+static inline __attribute__((always_inline)) void
+sift_level(struct item_t *items, size_t count, size_t index, struct item_t item,
+           uint32_t handle, int simd, const struct heap_slots *hs) {
+    if (IS_MIN_LEVEL(index)) {
+        sift_down(items, count, index, item, handle, -1, simd, hs);
+    } else {
+        sift_down(items, count, index, item, handle, 1, simd, hs);
+    }
+}
+
+/**
+ * @brief Trickle an item down from given index, with SIMD child selection
+ * when available, and a scalar one otherwise
+ *
+ * @param items: Array of items
+ * @param count: Number of items in the heap
+ * @param index: Index of the hole to start from
+ * @param item: Item to be placed
+ * @param handle: Its handle, when `hs` is not NULL
+ * @param hs: Position index to maintain, or NULL
+ */
+static inline void sift(struct item_t *items, size_t count, size_t index,
+                        struct item_t item, uint32_t handle,
+                        const struct heap_slots *hs) {
+#ifdef HEAP_SIMD
+    if (count >= HEAP_SIMD_MIN && heap_simd_enabled()) {
+        heap_simd_begin();
+        if (hs) {
+            sift_level(items, count, index, item, handle, 1, hs);
+        } else {
+            sift_level(items, count, index, item, handle, 1, NULL);
+        }
+        heap_simd_end();
+        return;
+    }
+#endif
+    if (hs) {
+        sift_level(items, count, index, item, handle, 0, hs);
+    } else {
+        sift_level(items, count, index, item, handle, 0, NULL);
+    }
+}
+
+/**
+ * @brief Trickle the item at given index down to its place in the min-max
+ * heap. This method assumes that the subtrees are already heapified.
+ *
+ * @param items: Array of items
+ * @param count: Number of items in the heap
+ * @param index: Index to subtree to be heapified
+ * @param hs: Position index to maintain, or NULL
+ */
+static inline void heapify(struct item_t *items, size_t count, size_t index,
+                           const struct heap_slots *hs) {
+    sift(items, count, index, items[index], heap_handle(hs, index), hs);
+}
+
+/**
+ * @brief Move an item from given index (a hole) up through its grandparents,
+ * which are on the same kind of level, and store it at its place.
+ *
+ * @param items: Array of items
+ * @param index: Index of the hole
+ * @param item: Item to be placed
+ * @param handle: Its handle, when `hs` is not NULL
+ * @param dir: -1 when moving up through min levels, +1 through max levels
+ * @param hs: Position index to maintain, or NULL
+ *
+ * @returns Final index of the item
+ */
+static inline size_t bubble_up(struct item_t *items, size_t index, struct item_t item,
+                               uint32_t handle, int dir, const struct heap_slots *hs) {
+    while (index > HEAP_ARITY) {
+        size_t grand = PARENT(PARENT(index));
+        if (!precedes(item.priority, items[grand].priority, dir)) {
+            break;
+        }
+        heap_move(items, hs, index, grand);
+        index = grand;
+    }
+    heap_put(items, hs, index, item, handle);
+    return index;
+}
+
+/**
+ * @brief Restore the min-max heap property around an item that was placed at
+ * (or had its priority changed at) given index.
+ *
+ * If the item is out of order with its parent, which is on the opposite kind
+ * of level, the parent's item moves down into its slot and is trickled down
+ * from there, while the item moves up through the parent's levels. Otherwise
+ * the item either moves up through its own kind of levels or, if it stays,
+ * is trickled down.
+ *
+ * @param items: Array of items
+ * @param count: Number of items in the heap
+ * @param index: Index of the item
+ * @param hs: Position index to maintain, or NULL
+ */
+static inline void fix_item(struct item_t *items, size_t count, size_t index,
+                            const struct heap_slots *hs) {
+    int dir = IS_MIN_LEVEL(index) ? -1 : 1;
+    struct item_t item = items[index];
+    uint32_t handle = heap_handle(hs, index);
+
+    if (index > 0 && precedes(item.priority, items[PARENT(index)].priority, -dir)) {
+        heap_move(items, hs, index, PARENT(index));
+        bubble_up(items, PARENT(index), item, handle, -dir, hs);
+        heapify(items, count, index, hs);
+        return;
+    }
+
+    if (bubble_up(items, index, item, handle, dir, hs) == index) {
+        heapify(items, count, index, hs);
+    }
+}
+
+/**
+ * @brief Insert an item, the array must have room for `*count + 1` items
+ *
+ * @param items: Array of items
+ * @param count: Pointer to the number of items in the heap, incremented
+ * @param item: Item to be inserted
+ * @param handle: Its handle, when `hs` is not NULL
+ * @param hs: Position index to maintain, or NULL
+ */
+static inline void heap_push(struct item_t *items, size_t *count, struct item_t item,
+                             uint32_t handle, const struct heap_slots *hs) {
+    size_t index = (*count)++;
+    heap_put(items, hs, index, item, handle);
+    fix_item(items, *count, index, hs);
+}
+
+/**
+ * @brief Turn an arbitrary array into a heap, bottom-up in O(count)
+ *
+ * @param items: Array of items
+ * @param count: Number of items in the array
+ * @param hs: Position index to maintain, or NULL; `slots` must already hold
+ *            the handle of every item
+ */
+static inline void heap_build(struct item_t *items, size_t count,
+                              const struct heap_slots *hs) {
+    size_t index;
+
+    if (count < 2) {
+        return;
+    }
+    /* Only the nodes up to the last item's parent have children */
+    for (index = PARENT(count - 1) + 1; index-- > 0; ) {
+        heapify(items, count, index, hs);
+    }
+}
+
+/**
+ * @brief Check that an array is a min-max heap, in O(count). Comparing every
+ * item with its parent and grandparent is enough, as the order then holds
+ * down every path by induction.
+ *
+ * @param items: Array of items
+ * @param count: Number of items in the array
+ *
+ * @returns Non-zero when no item on a min (max) level has a higher (lower)
+ *          priority than one of its descendants
+ */
+static inline int heap_valid(const struct item_t *items, size_t count) {
+    size_t index;
+
+    for (index = 1; index < count; index++) {
+        size_t parent = PARENT(index);
+        int dir = IS_MIN_LEVEL(parent) ? -1 : 1;
+
+        if (precedes(items[index].priority, items[parent].priority, dir)) {
+            return 0;
+        }
+        /* The grandparent is on a level of the other kind */
+        if (parent > 0 &&
+                precedes(items[index].priority, items[PARENT(parent)].priority, -dir)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Remove the item at the root or at `heap_max_index`. The last item
+ * moves into the hole and, being no smaller than the root and no larger than
+ * the maximum, only needs to trickle down.
+ *
+ * @param items: Array of items
+ * @param count: Pointer to the number of items in the heap, at least 1,
+ *               decremented
+ * @param index: 0 or `heap_max_index(items, *count)`
+ * @param hs: Position index to maintain, or NULL; the caller reads the
+ *            removed item's handle from `slots[index]` beforehand
+ *
+ * @returns The removed item
+ */
+static inline struct item_t heap_pop(struct item_t *items, size_t *count, size_t index,
+                                     const struct heap_slots *hs) {
+    struct item_t item = items[index];
+    size_t last = --(*count);
+
+    if (index < last) {
+        sift(items, last, index, items[last], heap_handle(hs, last), hs);
+    }
+    return item;
+}
+
+/**
+ * @brief Remove the item at any index
+ *
+ * @param items: Array of items
+ * @param count: Pointer to the number of items in the heap, decremented
+ * @param index: Index of the item to be removed, less than `*count`
+ * @param hs: Position index to maintain, or NULL
+ */
+static inline void heap_delete(struct item_t *items, size_t *count, size_t index,
+                               const struct heap_slots *hs) {
+    /* Move the last item into the hole and restore the heap around it */
+    (*count)--;
+    if (index != *count) {
+        heap_move(items, hs, index, *count);
+        fix_item(items, *count, index, hs);
+    }
+}
+
+#endif /* PQKMOD_HEAP_H */
@@ -0,0 +1,119 @@
+/**
+ * CS60038 - Advances in Operating Systems Design
+ * Assignment 1 (Part B) and Assigment 2
+ *
+ * Tracepoints of the priority-queue module, available under
+ * /sys/kernel/tracing/events/pqkmod/ for ftrace, perf and eBPF. Queues are
+ * identified by the id assigned when they are created.
+ *
+ * Author: Utkarsh Patel (18EC35034)
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pqkmod
+
+#if !defined(PQKMOD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PQKMOD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(pqkmod_item,
+
+	TP_PROTO(u32 id, s32 value, s32 priority, size_t count),
+
+	TP_ARGS(id, value, priority, count),
+
+	TP_STRUCT__entry(
+		__field(u32,	id)
+		__field(s32,	value)
+		__field(s32,	priority)
+		__field(size_t,	count)
+	),
+
+	TP_fast_assign(
+		__entry->id       = id;
+		__entry->value    = value;
+		__entry->priority = priority;
+		__entry->count    = count;
+	),
+
+	TP_printk("queue=%u value=%d priority=%d count=%zu",
+		  __entry->id, __entry->value, __entry->priority, __entry->count)
+);
+
+/* An item entered the queue, `count` includes it */
+DEFINE_EVENT(pqkmod_item, pqkmod_insert,
+	TP_PROTO(u32 id, s32 value, s32 priority, size_t count),
+	TP_ARGS(id, value, priority, count)
+);
+
+/* An item left the queue, `count` excludes it */
+DEFINE_EVENT(pqkmod_item, pqkmod_extract,
+	TP_PROTO(u32 id, s32 value, s32 priority, size_t count),
+	TP_ARGS(id, value, priority, count)
+);
+
+/* The capacity or the items array of the queue changed */
+TRACE_EVENT(pqkmod_resize,
+
+	TP_PROTO(u32 id, size_t capacity, size_t allocated, size_t count),
+
+	TP_ARGS(id, capacity, allocated, count),
+
+	TP_STRUCT__entry(
+		__field(u32,	id)
+		__field(size_t,	capacity)
+		__field(size_t,	allocated)
+		__field(size_t,	count)
+	),
+
+	TP_fast_assign(
+		__entry->id        = id;
+		__entry->capacity  = capacity;
+		__entry->allocated = allocated;
+		__entry->count     = count;
+	),
+
+	TP_printk("queue=%u capacity=%zu allocated=%zu count=%zu",
+		  __entry->id, __entry->capacity, __entry->allocated, __entry->count)
+);
+
+DECLARE_EVENT_CLASS(pqkmod_file,
+
+	TP_PROTO(u32 id, pid_t pid),
+
+	TP_ARGS(id, pid),
+
+	TP_STRUCT__entry(
+		__field(u32,	id)
+		__field(pid_t,	pid)
+	),
+
+	TP_fast_assign(
+		__entry->id  = id;
+		__entry->pid = pid;
+	),
+
+	TP_printk("queue=%u pid=%d", __entry->id, __entry->pid)
+);
+
+/* A file was opened, with a new anonymous queue */
+DEFINE_EVENT(pqkmod_file, pqkmod_open,
+	TP_PROTO(u32 id, pid_t pid),
+	TP_ARGS(id, pid)
+);
+
+/* A file attached to the queue was released */
+DEFINE_EVENT(pqkmod_file, pqkmod_release,
+	TP_PROTO(u32 id, pid_t pid),
+	TP_ARGS(id, pid)
+);
+
+#endif /* PQKMOD_TRACE_H */
+
+/* The header lives next to pqkmod.c, see CFLAGS_pqkmod.o in the Makefile */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pqkmod_trace
+#include <trace/define_trace.h>
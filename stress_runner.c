@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#include "pqkmod.h"
+
+#define RED         "\x1B[31m"
+#define GRN         "\x1B[32m"
+#define RESET       "\x1B[0m"
+
+#define QUEUE_SIZE  100
+
+
+/**
+ * Stress benchmark for the priority-queue module
+ *
+ * Runs 1, 2, 4, ... worker processes for a fixed duration each and reports
+ * the total throughput. Every worker repeatedly writes one (value, priority)
+ * record and reads one record back. By default each worker opens its own
+ * queue, so throughput should scale with the number of cores. With `-s` all
+ * workers share a single queue opened before forking, which exercises the
+ * per-queue lock instead. With `-r shards` the shared queue is relaxed (see
+ * PB2_SET_RELAXED) into that many heaps, 0 for one per CPU, and `-c` sets the
+ * number of heaps sampled per extract. Errors count failed reads and writes,
+ * which are expected in shared mode when another worker empties the queue.
+ *
+ * Usage: ./stress [-t seconds] [-w max_workers] [-s] [-r shards [-c choices]]
+ */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int relaxed_shards = -1;    /* -1 keeps the shared queue strict */
+static int relaxed_choices = 2;
+
+static int open_queue(const char *proc_file) {
+    int32_t num = QUEUE_SIZE;
+    /* Non-blocking, so shared-mode reads fail instead of waiting */
+    int fd = open(proc_file, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        perror(RED "<stress>: Could not open file!\n" RESET);
+        exit(1);
+    }
+    if (ioctl(fd, PB2_SET_CAPACITY, &num)) {
+        perror(RED "<stress>: Error while initializing queue!\n" RESET);
+        exit(1);
+    }
+    return fd;
+}
+
+static int open_shared_queue(const char *proc_file) {
+    int fd = open_queue(proc_file);
+    if (relaxed_shards >= 0) {
+        struct obj_relaxed relaxed = { relaxed_shards, relaxed_choices };
+        if (ioctl(fd, PB2_SET_RELAXED, &relaxed)) {
+            perror(RED "<stress>: Error while relaxing queue!\n" RESET);
+            exit(1);
+        }
+    }
+    return fd;
+}
+
+/* Body of a worker process, reports its operation count through `out` */
+static void worker(int fd, int id, double seconds, int start, int out) {
+    struct obj_item item;
+    long ops = 0, errors = 0;
+    char c;
+
+    /* Wait until the parent releases all workers at once */
+    read(start, &c, 1);
+
+    double deadline = now() + seconds;
+    while (now() < deadline) {
+        for (int i = 0; i < 256; i++) {
+            item.value    = id;
+            item.priority = 1 + (ops + i) % 1000;
+            if (write(fd, &item, sizeof(item)) != sizeof(item)) errors++;
+            if (read(fd, &item, sizeof(item)) != sizeof(item))  errors++;
+        }
+        ops += 512;
+    }
+
+    long result[2] = { ops, errors };
+    write(out, result, sizeof(result));
+    exit(0);
+}
+
+/* Run `workers` processes and return the number of operations per second */
+static double run(const char *proc_file, int workers, double seconds, int shared, long *errors) {
+    int start[2], out[2];
+    int shared_fd = shared ? open_shared_queue(proc_file) : -1;
+
+    if (pipe(start) || pipe(out)) {
+        perror(RED "<stress>: Could not create pipes!\n" RESET);
+        exit(1);
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (fork() == 0) {
+            close(start[1]);
+            int fd = shared ? shared_fd : open_queue(proc_file);
+            worker(fd, i, seconds, start[0], out[1]);
+        }
+    }
+
+    /* Give every worker time to open its queue, then start them together */
+    close(start[0]);
+    sleep(1);
+    close(start[1]);
+
+    /* Workers that fail to start exit without reporting */
+    close(out[1]);
+
+    long ops = 0, result[2];
+    *errors = 0;
+    while (read(out[0], result, sizeof(result)) == sizeof(result)) {
+        ops     += result[0];
+        *errors += result[1];
+    }
+    while (wait(NULL) > 0);
+
+    close(out[0]);
+    if (shared) close(shared_fd);
+    return ops / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    char proc_file[100] = "/proc/";
+    double seconds = 2;
+    int max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int shared = 0, opt;
+
+    while ((opt = getopt(argc, argv, "t:w:sr:c:")) != -1) {
+        switch (opt) {
+            case 't': seconds = atof(optarg); break;
+            case 'w': max_workers = atoi(optarg); break;
+            case 's': shared = 1; break;
+            case 'r': shared = 1; relaxed_shards = atoi(optarg); break;
+            case 'c': relaxed_choices = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-t seconds] [-w max_workers] [-s] "
+                    "[-r shards [-c choices]]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (shared && max_workers > QUEUE_SIZE) max_workers = QUEUE_SIZE;
+
+    strcat(proc_file, DEVICE_NAME);
+
+    /* Fail early when the module is not loaded */
+    close(open_queue(proc_file));
+
+    if (relaxed_shards >= 0) {
+        printf("[*] One relaxed queue (%d shards, %d choices), %.1f s per run\n", 
+            relaxed_shards, relaxed_choices, seconds);
+    } else {
+        printf("[*] %s queue(s), %.1f s per run\n", shared ? "One shared" : "Private", seconds);
+    }
+    printf("%8s %14s %8s %8s\n", "workers", "ops/sec", "speedup", "errors");
+
+    double base = 0;
+    for (int workers = 1; workers <= max_workers; ) {
+        long errors;
+        double rate = run(proc_file, workers, seconds, shared, &errors);
+        if (workers == 1) base = rate;
+        printf("%8d %14.0f %7.2fx %8ld\n", workers, rate, rate / base, errors);
+
+        /* Double the workers, always finishing with exactly `max_workers` */
+        if (workers == max_workers) break;
+        workers = workers * 2 > max_workers ? max_workers : workers * 2;
+    }
+
+    return 0;
+}